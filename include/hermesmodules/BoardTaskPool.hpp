@@ -0,0 +1,100 @@
+#ifndef HERMESMODULES_INCLUDE_BOARDTASKPOOL_HPP_
+#define HERMESMODULES_INCLUDE_BOARDTASKPOOL_HPP_
+
+#include "ers/Issue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dunedaq {
+
+ERS_DECLARE_ISSUE(hermesmodules,
+                  BoardAlreadyInGroup,
+                  "Hermes board " << board << " is already part of the group",
+                  ((std::string)board)
+                  );
+
+ERS_DECLARE_ISSUE(hermesmodules,
+                  BoardNotInGroup,
+                  "Hermes board " << board << " is not part of the group",
+                  ((std::string)board)
+                  );
+
+namespace hermesmodules {
+
+// Runs one task per named board on a pool of at most max_threads threads and
+// gathers the outcomes. It knows nothing of the hardware: the task decides
+// what is done with the board.
+class BoardTaskPool {
+
+public:
+
+  struct BoardResult {
+    std::string board;
+    bool ok = false;
+    bool timed_out = false;
+    std::string error;
+    std::chrono::milliseconds duration{0};
+  };
+
+  explicit BoardTaskPool(size_t max_threads);
+  ~BoardTaskPool();
+
+  BoardTaskPool(const BoardTaskPool&) = delete;
+  BoardTaskPool& operator=(const BoardTaskPool&) = delete;
+
+  // Boards are to be added before any task is run
+  void add_board(const std::string& name);
+
+  bool has_board(const std::string& name) const;
+
+  std::vector<std::string> get_boards() const;
+
+  // Run fn on every board and gather the outcomes, in board name order.
+  // A board is given up once fn has run for longer than timeout: the task
+  // carries on in the background and the board is reported as busy until it
+  // has completed. fn may outlive the call and must not refer to the
+  // caller's locals.
+  using BoardFn = std::function<void(const std::string&)>;
+  std::vector<BoardResult> for_each(BoardFn fn, std::chrono::milliseconds timeout);
+
+private:
+
+  struct Board {
+    // Set while a task is running on the board, possibly one that has been given up
+    std::atomic<bool> busy{false};
+  };
+
+  // Outcome of one for_each call, shared with the jobs that may outlive it
+  struct Gather;
+
+  void run_job(const std::shared_ptr<Gather>& gather, size_t index, Board& board, const BoardFn& fn);
+
+  void worker();
+
+  std::map<std::string, std::unique_ptr<Board>> m_boards;
+
+  // Number of threads running a task that has been given up
+  std::atomic<size_t> m_n_abandoned{0};
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<std::function<void()>> m_jobs;
+  bool m_stop = false;
+
+  std::vector<std::thread> m_workers;
+};
+
+}
+}
+
+#endif /* HERMESMODULES_INCLUDE_BOARDTASKPOOL_HPP_ */
@@ -0,0 +1,53 @@
+
+#ifndef HERMESMODULES_INCLUDE_COUNTEREXTENDER_HPP_
+#define HERMESMODULES_INCLUDE_COUNTEREXTENDER_HPP_
+
+#include <cstdint>
+
+namespace dunedaq {
+namespace hermesmodules {
+
+// Extends a free-running 32-bit hardware counter to a monotonic 64-bit value.
+// A counter going backwards is either a wrap or a counter clear (reset, power
+// cycle): it is considered a wrap only if the implied increment is plausible.
+class CounterExtender {
+
+public:
+
+  // Account for a new hardware reading. max_increment is the largest
+  // increment the counter can have made since the previous reading.
+  uint64_t update(uint32_t raw, double max_increment) {
+    if ( !m_valid ) {
+      m_valid = true;
+      m_last = raw;
+      m_total = raw;
+      return m_total;
+    }
+
+    uint32_t delta = raw - m_last;
+    if ( raw < m_last && delta > max_increment ) {
+      // Cleared since the last reading, count from zero
+      delta = raw;
+    }
+
+    m_total += delta;
+    m_last = raw;
+    return m_total;
+  }
+
+  // The hardware counter has been cleared, the next reading counts from zero
+  void rebase() { m_last = 0; }
+
+  uint64_t value() const { return m_total; }
+
+private:
+
+  bool m_valid = false;
+  uint32_t m_last = 0;
+  uint64_t m_total = 0;
+};
+
+}
+}
+
+#endif /* HERMESMODULES_INCLUDE_COUNTEREXTENDER_HPP_ */
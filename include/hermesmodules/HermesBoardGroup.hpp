@@ -0,0 +1,77 @@
+
+#ifndef HERMESMODULES_INCLUDE_HERMESBOARDGROUP_HPP_
+#define HERMESMODULES_INCLUDE_HERMESBOARDGROUP_HPP_
+
+#include "hermesmodules/BoardTaskPool.hpp"
+#include "hermesmodules/HermesCoreController.hpp"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+namespace hermesmodules {
+
+// Controls several Hermes boards from one process. Operations are run on all
+// boards concurrently, on a pool of at most max_threads threads, so that a
+// transition takes about as long as the slowest board instead of the sum.
+class HermesBoardGroup {
+
+public:
+
+  using BoardResult = BoardTaskPool::BoardResult;
+
+  explicit HermesBoardGroup(size_t max_threads);
+
+  HermesBoardGroup(const HermesBoardGroup&) = delete;
+  HermesBoardGroup& operator=(const HermesBoardGroup&) = delete;
+
+  // Boards are to be added before any operation is run
+  void add_board(const std::string& name, uhal::HwInterface hw);
+
+  HermesCoreController& get_board(const std::string& name);
+
+  std::vector<std::string> get_boards() const;
+
+  // Run fn on every board and gather the outcomes, in board name order.
+  // A board is given up once fn has run for longer than timeout: the
+  // operation carries on in the background (uhal has its own timeout) and
+  // the board is reported as busy until it has completed. fn may outlive
+  // the call and must not refer to the caller's locals.
+  using BoardFn = std::function<void(const std::string&, HermesCoreController&)>;
+  std::vector<BoardResult> for_each(BoardFn fn, std::chrono::milliseconds timeout);
+
+  // Disable all links and apply the desired link configuration of each board
+  std::vector<BoardResult> configure(const std::map<std::string, std::vector<HermesCoreController::LinkConfig>>& desired,
+                                     std::chrono::milliseconds timeout,
+                                     bool force=false);
+
+  // Enable the links of each board and wait for them to be ready for at most ready_timeout
+  std::vector<BoardResult> start(const std::map<std::string, std::vector<uint16_t>>& links,
+                                 std::chrono::milliseconds timeout,
+                                 std::chrono::milliseconds ready_timeout);
+
+  // Disable the links of each board
+  std::vector<BoardResult> stop(const std::map<std::string, std::vector<uint16_t>>& links, std::chrono::milliseconds timeout);
+
+private:
+
+  // Boards named in a per-board argument must be part of the group
+  template<typename T>
+  void check_boards(const std::map<std::string, T>& args) const;
+
+  // Not modified once operations have started, the pool threads look the
+  // controllers up without locking
+  std::map<std::string, std::unique_ptr<HermesCoreController>> m_ctrls;
+
+  // Declared last: its threads are joined before the controllers are destroyed
+  BoardTaskPool m_pool;
+};
+
+}
+}
+
+#endif /* HERMESMODULES_INCLUDE_HERMESBOARDGROUP_HPP_ */
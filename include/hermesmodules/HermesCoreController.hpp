@@ -5,7 +5,17 @@
 #include "ers/Issue.hpp"
 #include "uhal/uhal.hpp"
 
+#include "hermesmodules/CounterExtender.hpp"
 #include "hermesmodules/opmon/hermescontroller.pb.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
 namespace dunedaq {
 
 ERS_DECLARE_ISSUE(hermesmodules,
@@ -33,6 +43,18 @@ ERS_DECLARE_ISSUE(hermesmodules,
                   ((uint16_t)link)((bool)err)((bool)eth_rdy)((bool)src_rdy)((bool)udp_rdy)
                   );
 
+ERS_DECLARE_ISSUE(hermesmodules,
+                  InvalidRegisterAccess,
+                  "Invalid access to " << node << ": " << reason,
+                  ((std::string)node)((std::string)reason)
+                  );
+
+ERS_DECLARE_ISSUE(hermesmodules,
+                  CoreNotReadyAfterReset,
+                  "Hermes core not ready " << timeout_ms << " ms after reset: " << reason,
+                  ((int64_t)timeout_ms)((std::string)reason)
+                  );
+
 namespace hermesmodules {
 
 class HermesCoreController {
@@ -56,44 +78,354 @@ public:
     uint16_t slotid;
   };
 
+  struct LinkSnapshot {
+    uint16_t link;
+    LinkGeoInfo geo;
+    opmon::LinkInfo stats;
+    std::vector<opmon::BufferInfo> buffers;
+  };
+
+  // Data path configuration of a link, as written by config_udp and config_mux
+  struct LinkConfig {
+    uint16_t link;
+    uint64_t src_mac;
+    uint32_t src_ip;
+    uint16_t src_port;
+    uint64_t dst_mac;
+    uint32_t dst_ip;
+    uint16_t dst_port;
+    uint32_t filters;
+    uint16_t det;
+    uint16_t crate;
+    uint16_t slot;
+    // Take the source addresses from the core ports instead of the registers
+    bool use_external = false;
+  };
+
+  // Collects writes, reads and selector changes and sends them to the
+  // hardware with a single dispatch. Transactions are executed in the order
+  // they were queued; values returned by read become valid after dispatch.
+  class Batch {
+
+  public:
+
+    explicit Batch(HermesCoreController& ctrl);
+
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+
+    void write(const uhal::Node& node, uint32_t value);
+
+    uhal::ValWord<uint32_t> read(const uhal::Node& node);
+
+    // Incremental read of size words starting from the node address
+    uhal::ValVector<uint32_t> read_block(const uhal::Node& node, uint32_t size);
+
+    void sel_tx_mux(uint16_t i);
+
+    void sel_tx_mux_buf(uint16_t i);
+
+    void sel_udp_core(uint16_t i);
+
+    // Staged transactions not yet committed are committed first
+    void dispatch();
+
+    // Hold the transactions queued from now on until commit_staged passes
+    // them to the client, or drop_staged discards them and restores the
+    // selector shadows, so that a group of transactions is sent whole or not
+    // at all. Staged accesses are checked as uhal does when queuing them;
+    // staged reads return values filled in by dispatch.
+    void stage();
+
+    void commit_staged();
+
+    void drop_staged();
+
+    HermesCoreController& controller() { return m_ctrl; }
+
+  private:
+
+    void check_access(const uhal::Node& node, uint32_t permission) const;
+
+    HermesCoreController& m_ctrl;
+
+    bool m_staging = false;
+    std::vector<std::function<void()>> m_staged;
+
+    // Selector shadows when staging started
+    std::optional<uint16_t> m_saved_tx_mux_sel;
+    std::optional<uint16_t> m_saved_udp_core_sel;
+    std::vector<std::optional<uint16_t>> m_saved_tx_mux_buf_sel;
+
+    // Reads passed to the client, with the values handed out when staged
+    std::vector<std::pair<uhal::ValWord<uint32_t>, uhal::ValWord<uint32_t>>> m_staged_words;
+    std::vector<std::pair<uhal::ValVector<uint32_t>, uhal::ValVector<uint32_t>>> m_staged_blocks;
+  };
+
+  // Dispatch latency histogram: bucket i counts round trips shorter than
+  // 2^i us, the last bucket collects everything slower
+  static constexpr size_t s_n_latency_buckets = 18;
+
+  // Bounds of the interval between two reads when waiting for links to be ready
+  static constexpr std::chrono::microseconds s_ready_poll_min{100};
+  static constexpr std::chrono::microseconds s_ready_poll_max{50000};
+
+  static constexpr std::chrono::milliseconds s_reset_timeout{2000};
+
+  // Minimum time a reset bit is held asserted before being released
+  static constexpr std::chrono::microseconds s_reset_pulse_width{1000};
+
   explicit HermesCoreController(uhal::HwInterface, std::string readout_id="");
   virtual ~HermesCoreController();
 
   const CoreInfo& get_info() const { return m_core_info; }
 
+  // IPbus round-trip statistics, safe to call from any thread.
+  // The maximum latency is reset at every call.
+  opmon::DispatchInfo get_dispatch_info();
+
+  std::array<uint64_t, s_n_latency_buckets> get_dispatch_latency_histogram() const;
+
   void sel_tx_mux(uint16_t i) ;
 
   void sel_tx_mux_buf(uint16_t i);
 
   void sel_udp_core(uint16_t i);
 
-  void reset(bool nuke=false);
+  // Forget the selector shadow copies, forcing the next selections to be written
+  void invalidate_selectors();
+
+  // Pulse the core reset bits, each held for s_reset_pulse_width, then wait
+  // for the PCS/PMA status (when available in firmware) of the given links to
+  // be ready again. With wait_eth, their ethernet is waited for too, which
+  // needs a peer on the link. No link is waited for if links is empty.
+  // Returns the time taken by the core to come back, zero if nothing was
+  // waited for.
+  std::chrono::microseconds reset(bool nuke=false, const std::vector<uint16_t>& links={}, std::chrono::milliseconds timeout=s_reset_timeout, bool wait_eth=false);
+
+  // Duration of the last reset, as returned by reset
+  std::chrono::microseconds get_last_reset_duration() const { return m_last_reset_duration; }
 
   bool is_link_in_error(uint16_t link, bool do_throw=false);
 
   void enable(uint16_t link, bool enable);
 
+  void enable(Batch& batch, uint16_t link, bool enable);
+
   void config_mux(uint16_t link, uint16_t det, uint16_t crate, uint16_t slot);
 
+  void config_mux(Batch& batch, uint16_t link, uint16_t det, uint16_t crate, uint16_t slot);
+
   void config_udp(uint16_t link, uint64_t src_mac, uint32_t src_ip, uint16_t src_port, uint64_t dst_mac, uint32_t dst_ip, uint16_t dst_port, uint32_t filters);
 
+  void config_udp(Batch& batch, uint16_t link, uint64_t src_mac, uint32_t src_ip, uint16_t src_port, uint64_t dst_mac, uint32_t dst_ip, uint16_t dst_port, uint32_t filters);
+
   void config_fake_src(uint16_t link, uint16_t n_src, uint16_t data_len, uint16_t rate);
 
+  // Input buffers are left enabled according to en_buf once the sources are configured
+  void config_fake_src(Batch& batch, uint16_t link, uint16_t n_src, uint16_t data_len, uint16_t rate, bool en_buf);
+
+  // Read back the udp_core and mux configuration of all links in one dispatch
+  std::vector<LinkConfig> read_link_configs();
+
+  // Links whose tx_mux reports an error, read in one dispatch
+  std::vector<uint16_t> read_links_in_error();
+
+  // Bring the links to the desired configuration, writing only the registers
+  // that differ. The core is reset only if a udp_core register differs or if
+  // force is set; differences in the mux geo info alone are written without
+  // a reset. Returns whether the core was reset.
+  bool apply_link_configs(const std::vector<LinkConfig>& desired, bool force=false);
+
+  struct LinkReadiness {
+    uint16_t link;
+    bool ready;
+    // From the start of the wait to the first read reporting the link ready
+    std::chrono::microseconds time_to_ready;
+  };
+
+  // Poll the tx_mux status of the links until all are ready or the timeout
+  // expires, with one batched read per iteration and exponentially growing
+  // intervals. If do_throw is set, the first link not ready in time is
+  // reported with LinkInError.
+  std::vector<LinkReadiness> wait_links_ready(const std::vector<uint16_t>& links, std::chrono::milliseconds timeout, bool do_throw=true);
+
   LinkGeoInfo read_link_geo_info(uint16_t link);
 
   opmon::LinkInfo read_link_stats(uint16_t link);
 
+  std::vector<opmon::BufferInfo> read_buffer_stats(uint16_t link);
+
+  // Counter rates are filled in when the firmware provides the samp block,
+  // using the sample timestamps of this and of the previous snapshot
+  std::vector<LinkSnapshot> snapshot_all_links();
+
 
 private:
 
+  struct LinkStatsWords {
+    uhal::ValWord<uint32_t> err;
+    uhal::ValWord<uint32_t> eth_rdy;
+    uhal::ValWord<uint32_t> src_rdy;
+    uhal::ValWord<uint32_t> udp_rdy;
+    uhal::ValWord<uint32_t> rx_arp_count;
+    uhal::ValWord<uint32_t> rx_ping_count;
+    uhal::ValWord<uint32_t> rx_udp_count;
+    uhal::ValWord<uint32_t> tx_arp_count;
+    uhal::ValWord<uint32_t> tx_ping_count;
+    uhal::ValWord<uint32_t> tx_udp_count;
+  };
+
+  // 64-bit counter split in two registers
+  struct Counter64 {
+    const uhal::Node* lo;
+    const uhal::Node* hi;
+  };
+
+  // Nodes used by the controller, resolved once by load_hw_info
+  struct Registers {
+    const uhal::Node* nuke;
+    const uhal::Node* soft_rst;
+    const uhal::Node* samp; // nullptr when not available in firmware
+    Counter64 samp_ts;
+    const uhal::Node* pcs_pma_rx_status; // nullptr when not available in firmware
+    const uhal::Node* pcs_pma_tx_status;
+
+    const uhal::Node* tx_mux_sel;
+    const uhal::Node* udp_core_sel;
+
+    const uhal::Node* tx_mux_en;
+    const uhal::Node* tx_mux_en_buf;
+    const uhal::Node* tx_mux_tx_en;
+    const uhal::Node* tx_mux_sel_buf;
+
+    const uhal::Node* tx_mux_stat;
+    const uhal::Node* tx_mux_err;
+    const uhal::Node* tx_mux_eth_rdy;
+    const uhal::Node* tx_mux_src_rdy;
+    const uhal::Node* tx_mux_udp_rdy;
+
+    const uhal::Node* mux_detid;
+    const uhal::Node* mux_crate;
+    const uhal::Node* mux_slot;
+
+    const uhal::Node* buf_fake_en;
+    const uhal::Node* buf_dlen;
+    const uhal::Node* buf_rate_rdx;
+
+    const uhal::Node* udp_use_external;
+    const uhal::Node* udp_src_mac_lower;
+    const uhal::Node* udp_src_mac_upper;
+    const uhal::Node* udp_src_ip;
+    const uhal::Node* udp_src_port;
+    const uhal::Node* udp_dst_mac_lower;
+    const uhal::Node* udp_dst_mac_upper;
+    const uhal::Node* udp_dst_ip;
+    const uhal::Node* udp_dst_port;
+    const uhal::Node* udp_filter_control;
+
+    const uhal::Node* rx_arp_count;
+    const uhal::Node* rx_ping_count;
+    const uhal::Node* rx_udp_count;
+    const uhal::Node* tx_arp_count;
+    const uhal::Node* tx_ping_count;
+    const uhal::Node* tx_udp_count;
+
+    // Input buffer status and counters, read as a single block from buf_stat
+    const uhal::Node* buf_stat;
+    const uhal::Node* buf_rx_stat;
+    const uhal::Node* buf_tx_stat;
+    const uhal::Node* buf_lwm;
+    const uhal::Node* buf_hwm;
+    const uhal::Node* buf_llwm;
+    const uhal::Node* buf_lhwm;
+    Counter64 buf_ts;
+    Counter64 buf_vol;
+    Counter64 buf_blk_acc;
+    Counter64 buf_blk_rej;
+    Counter64 buf_blk_oflow;
+    Counter64 buf_blk_longlast;
+    Counter64 buf_blk_lastnotval;
+    uint32_t buf_block_size;
+  };
+
   void load_hw_info();
 
+  // Send the queued transactions, timing the round trip
+  void dispatch();
+
+  // Queue the link statistics reads, the link must be already selected
+  LinkStatsWords queue_link_stats(Batch& batch);
+
+  opmon::LinkInfo decode_link_stats(const LinkStatsWords& words) const;
+
+  // Registers to be written to bring a link from current to desired
+  struct LinkConfigDiff {
+    std::vector<std::pair<const uhal::Node*, uint32_t>> udp_core;
+    std::vector<std::pair<const uhal::Node*, uint32_t>> tx_mux;
+
+    bool empty() const { return udp_core.empty() && tx_mux.empty(); }
+  };
+
+  LinkConfigDiff diff_link_config(const LinkConfig& current, const LinkConfig& desired) const;
+
+  void queue_link_config_diff(Batch& batch, uint16_t link, const LinkConfigDiff& diff);
+
+  // Queue one block read per input buffer, the link must be already selected
+  std::vector<uhal::ValVector<uint32_t>> queue_buffer_stats(Batch& batch);
+
+  opmon::BufferInfo decode_buffer_stats(const uhal::ValVector<uint32_t>& block) const;
+
   uhal::HwInterface m_hw;
 
   const uhal::Node& m_readout;
 
   CoreInfo m_core_info;
 
+  Registers m_regs {};
+
+  // Shadow copies of the selector registers, used to skip redundant writes.
+  // They assume that this controller is the only one driving the selectors.
+  std::optional<uint16_t> m_tx_mux_sel;
+  std::optional<uint16_t> m_udp_core_sel;
+  // sel_buf lives in the tx_mux csr, there is one per link
+  std::vector<std::optional<uint16_t>> m_tx_mux_buf_sel;
+
+  // Latched counters of the last snapshot, the reference for rates
+  struct CounterSample {
+    uint64_t ts;
+    std::vector<LinkSnapshot> links;
+  };
+  std::optional<CounterSample> m_last_sample;
+
+  void update_rates(uint64_t sample_ts, std::vector<LinkSnapshot>& snapshots);
+
+  // 64-bit software extension of the 32-bit UDP packet counters
+  struct LinkCounters {
+    CounterExtender rcvd_arp;
+    CounterExtender rcvd_ping;
+    CounterExtender rcvd_udp;
+    CounterExtender sent_arp;
+    CounterExtender sent_ping;
+    CounterExtender sent_udp;
+    std::chrono::steady_clock::time_point last_update;
+  };
+  std::vector<LinkCounters> m_link_counters;
+
+  std::chrono::microseconds m_last_reset_duration{0};
+
+  // Last time to ready measured by wait_links_ready, zero if not measured since the last reset
+  std::vector<std::chrono::microseconds> m_link_time_to_ready;
+
+  std::atomic<uint64_t> m_n_dispatches {0};
+  std::atomic<uint64_t> m_n_failed_dispatches {0};
+  std::atomic<uint64_t> m_dispatch_time_us {0};
+  std::atomic<uint64_t> m_max_dispatch_time_us {0};
+  std::array<std::atomic<uint64_t>, s_n_latency_buckets> m_dispatch_latency_hist {};
+
+  // Replace the raw hardware counts in info with the extended ones
+  void extend_link_counters(uint16_t link, opmon::LinkInfo& info);
+
 };
 
 }
@@ -0,0 +1,90 @@
+
+#ifndef HERMESMODULES_INCLUDE_HERMESCORESTRAND_HPP_
+#define HERMESMODULES_INCLUDE_HERMESCORESTRAND_HPP_
+
+#include "hermesmodules/HermesCoreController.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+namespace dunedaq {
+namespace hermesmodules {
+
+// Single-threaded executor serializing every access to a HermesCoreController,
+// so that selector writes and the accesses depending on them never interleave.
+// Command tasks always run before monitoring tasks waiting in the queue.
+class HermesCoreStrand {
+
+public:
+
+  enum class Priority { kCommand, kMonitoring };
+
+  explicit HermesCoreStrand(HermesCoreController& ctrl);
+  ~HermesCoreStrand();
+
+  HermesCoreStrand(const HermesCoreStrand&) = delete;
+  HermesCoreStrand& operator=(const HermesCoreStrand&) = delete;
+
+  // Queue operations in a batch. Adjacent batch tasks with the same priority
+  // are merged and sent with a single dispatch; the future is ready once
+  // the batch has been dispatched.
+  std::future<void> submit(Priority prio, std::function<void(HermesCoreController::Batch&)> queue_fn);
+
+  // Run a task with exclusive access to the controller
+  template<typename F>
+  auto run(Priority prio, F&& fn) -> std::future<std::invoke_result_t<F, HermesCoreController&>>;
+
+private:
+
+  struct Task {
+    // Exactly one of the two is set
+    std::function<void(HermesCoreController::Batch&)> queue_fn;
+    std::function<void(HermesCoreController&)> exclusive_fn;
+    std::shared_ptr<std::promise<void>> done;
+  };
+
+  void enqueue(Priority prio, Task task);
+
+  void worker();
+
+  void run_batch(std::unique_lock<std::mutex>& lock, std::deque<Task>& queue);
+
+  HermesCoreController& m_ctrl;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<Task> m_command_queue;
+  std::deque<Task> m_monitoring_queue;
+  bool m_stop = false;
+
+  std::thread m_worker;
+};
+
+
+//-----------------------------------------------------------------------------
+template<typename F>
+auto
+HermesCoreStrand::run(Priority prio, F&& fn) -> std::future<std::invoke_result_t<F, HermesCoreController&>> {
+
+  using R = std::invoke_result_t<F, HermesCoreController&>;
+
+  auto task = std::make_shared<std::packaged_task<R(HermesCoreController&)>>(std::forward<F>(fn));
+  auto result = task->get_future();
+
+  Task t;
+  t.exclusive_fn = [task](HermesCoreController& ctrl) { (*task)(ctrl); };
+  this->enqueue(prio, std::move(t));
+
+  return result;
+}
+
+}
+}
+
+#endif /* HERMESMODULES_INCLUDE_HERMESCORESTRAND_HPP_ */
@@ -0,0 +1,110 @@
+
+#ifndef HERMESMODULES_INCLUDE_REGISTERMAP_HPP_
+#define HERMESMODULES_INCLUDE_REGISTERMAP_HPP_
+
+#include <cstdint>
+#include <vector>
+
+namespace dunedaq {
+namespace hermesmodules {
+namespace regmap {
+
+// Address and mask of a register field, as described in the address table
+struct Field {
+  uint32_t address;
+  uint32_t mask;
+};
+
+constexpr uint32_t
+mask_shift(uint32_t mask) {
+  uint32_t shift = 0;
+  while ( mask && !(mask & 0x1) ) {
+    mask >>= 1;
+    ++shift;
+  }
+  return shift;
+}
+
+// Compile-time accessors for a field of the generated register map
+template<const Field& F>
+struct Register {
+
+  static_assert(F.mask != 0, "Register fields must have a non-null mask");
+
+  static constexpr uint32_t address = F.address;
+  static constexpr uint32_t mask = F.mask;
+  static constexpr uint32_t shift = mask_shift(F.mask);
+  static constexpr bool is_full_word = (F.mask == 0xffffffff);
+
+  // Place value in the field position of a register word
+  static constexpr uint32_t pack(uint32_t value) { return (value << shift) & mask; }
+
+  // Extract the field value from a register word
+  static constexpr uint32_t unpack(uint32_t word) { return (word & mask) >> shift; }
+};
+
+// Combine values of fields sharing the same register into a single word
+template<const Field&... Fs, typename... Vs>
+constexpr uint32_t
+pack_fields(Vs... values) {
+  static_assert(sizeof...(Fs) == sizeof...(Vs), "One value per field is required");
+  return (Register<Fs>::pack(values) | ...);
+}
+
+namespace ipbus {
+
+// IPbus 2.0 transaction types
+enum TransactionType : uint32_t {
+  kRead = 0x0,
+  kWrite = 0x1,
+  kNonIncRead = 0x2,
+  kNonIncWrite = 0x3,
+  kRMWBits = 0x4,
+  kRMWSum = 0x5
+};
+
+constexpr uint32_t k_protocol_version = 0x2;
+
+constexpr uint32_t
+packet_header(uint16_t packet_id) {
+  return (k_protocol_version << 28) | (uint32_t(packet_id) << 8) | 0xf0;
+}
+
+constexpr uint32_t
+transaction_header(uint16_t transaction_id, uint8_t n_words, TransactionType type) {
+  return (k_protocol_version << 28) | ((uint32_t(transaction_id) & 0xfff) << 16) | (uint32_t(n_words) << 8) | (uint32_t(type) << 4) | 0xf;
+}
+
+// Append a field read to a control packet
+template<const Field& F>
+void
+queue_read(std::vector<uint32_t>& packet, uint16_t transaction_id) {
+  packet.push_back(transaction_header(transaction_id, 1, kRead));
+  packet.push_back(F.address);
+}
+
+// Append a field write to a control packet. Partial fields are written with
+// a read-modify-write, leaving the other bits of the register untouched.
+template<const Field& F>
+void
+queue_write(std::vector<uint32_t>& packet, uint16_t transaction_id, uint32_t value) {
+  using reg = Register<F>;
+  if constexpr ( reg::is_full_word ) {
+    packet.push_back(transaction_header(transaction_id, 1, kWrite));
+    packet.push_back(F.address);
+    packet.push_back(value);
+  } else {
+    packet.push_back(transaction_header(transaction_id, 1, kRMWBits));
+    packet.push_back(F.address);
+    packet.push_back(~reg::mask);
+    packet.push_back(reg::pack(value));
+  }
+}
+
+} // namespace ipbus
+
+} // namespace regmap
+} // namespace hermesmodules
+} // namespace dunedaq
+
+#endif /* HERMESMODULES_INCLUDE_REGISTERMAP_HPP_ */
@@ -20,10 +20,12 @@
 #include "HermesModule.hpp"
 #include "hermesmodules/opmon/hermescontroller.pb.h"
 
+#include <optional>
 #include <string>
 #include <netinet/ether.h>
 #include <arpa/inet.h>
 #include <fmt/core.h>
+#include <fmt/ranges.h>
 #include "logging/Logging.hpp"
 
 
@@ -60,6 +62,12 @@ HermesModule::HermesModule(const std::string& name)
   register_command("stop", &HermesModule::do_stop);
 }
 
+//-----------------------------------------------------------------------------
+HermesModule::~HermesModule()
+{
+  this->stop_poller();
+}
+
 //-----------------------------------------------------------------------------
 void
 HermesModule::init(std::shared_ptr<appfwk::ModuleConfiguration> mcfg)
@@ -80,38 +88,115 @@ HermesModule::generate_opmon_data()
   ginfo.set_amount_since_last_get_info_call( m_amount_since_last_get_info_call.exchange(0) );
   publish( std::move(ginfo) );
 
-  if ( ! m_core_controller ) return ;
-  
-  const auto& core_info = m_core_controller->get_info();
+  // Only copy out the latest snapshot, hardware access happens in the poller
+  auto snapshot = std::atomic_load(&m_snapshot);
+  if ( ! snapshot ) return ;
+
+  publish( opmon::DispatchInfo(snapshot->dispatch) );
+
+  const auto& hist = snapshot->dispatch_latency_hist;
+  for ( size_t i(0); i<hist.size(); ++i ) {
+    opmon::DispatchLatencyBucket bucket;
+    bucket.set_count(hist[i]);
+    std::string upper = ( i+1 < hist.size() ? std::to_string(1ul << i) : "inf" );
+    publish( std::move(bucket), { {"lt_us", upper} } );
+  }
+
+  for ( const auto& snap : snapshot->links ) {
+    publish( opmon::LinkInfo(snap.stats),
+             { {"detector",std::to_string(snap.geo.detid)},
+               {"crate",   std::to_string(snap.geo.crateid)},
+               {"slot",    std::to_string(snap.geo.slotid)},
+               {"link",    std::to_string(snap.link)} } );
+
+    for ( size_t j(0); j<snap.buffers.size(); ++j ) {
+      publish( opmon::BufferInfo(snap.buffers[j]),
+               { {"detector",std::to_string(snap.geo.detid)},
+                 {"crate",   std::to_string(snap.geo.crateid)},
+                 {"slot",    std::to_string(snap.geo.slotid)},
+                 {"link",    std::to_string(snap.link)},
+                 {"buffer",  std::to_string(j)} } );
+    } // loop over buffers
+  } // loop over links
+
+}
 
-  for ( uint16_t i(0); i<core_info.n_mgt; ++i){
+//-----------------------------------------------------------------------------
+void
+HermesModule::start_poller()
+{
+  std::lock_guard<std::mutex> lock(m_poller_mutex);
+  if ( m_poller_running ) return;
+
+  m_poller_running = true;
+  m_poller = std::thread(&HermesModule::poll_hardware, this);
+}
+
+//-----------------------------------------------------------------------------
+void
+HermesModule::stop_poller()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_poller_mutex);
+    m_poller_running = false;
+  }
+  m_poller_cv.notify_all();
+
+  if ( m_poller.joinable() ) {
+    m_poller.join();
+  }
+}
 
+//-----------------------------------------------------------------------------
+void
+HermesModule::poll_hardware()
+{
+  std::unique_lock<std::mutex> poller_lock(m_poller_mutex);
+
+  while ( m_poller_running ) {
+    poller_lock.unlock();
+
+    std::shared_ptr<const HwSnapshot> snapshot;
     try {
-      auto geo_info = m_core_controller->read_link_geo_info(i);
-      publish( m_core_controller->read_link_stats(i),
-	       { {"detector",std::to_string(geo_info.detid)},
-		 {"crate",   std::to_string(geo_info.crateid)},
-		 {"slot",    std::to_string(geo_info.slotid)},
-		 {"link",    std::to_string(i)} } );
-    } catch ( const uhal::exception::exception& e ) {
-      ers::warning(FailedToRetrieveStats(ERS_HERE, i, e));  
+      snapshot = m_strand->run(HermesCoreStrand::Priority::kMonitoring, [](HermesCoreController& ctrl) {
+        auto snap = std::make_shared<HwSnapshot>();
+        snap->links = ctrl.snapshot_all_links();
+        snap->dispatch = ctrl.get_dispatch_info();
+        snap->dispatch_latency_hist = ctrl.get_dispatch_latency_histogram();
+        return std::shared_ptr<const HwSnapshot>(std::move(snap));
+      }).get();
+    } catch ( const ers::Issue& e ) {
+      ers::warning(FailedToRetrieveLinksSnapshot(ERS_HERE, m_core_controller->get_info().n_mgt, e));
+    } catch ( const std::exception& e ) {
+      // uhal exceptions included: nothing may escape the poller thread
+      ers::warning(FailedToRetrieveLinksSnapshot(ERS_HERE, m_core_controller->get_info().n_mgt, e));
     }
-      
-  } // loop over links
-  
+
+    // A failed poll clears the snapshot rather than republishing stale values
+    std::atomic_store(&m_snapshot, snapshot);
+
+    poller_lock.lock();
+    m_poller_cv.wait_for(poller_lock, s_poll_interval, [this] { return !m_poller_running; });
+  }
 }
 
 //-----------------------------------------------------------------------------
 void
 HermesModule::do_conf(const data_t& /*conf_as_json*/)
 { 
+  // The controller is about to be replaced
+  this->stop_poller();
+  std::atomic_store(&m_snapshot, std::shared_ptr<const HwSnapshot>());
+
   // Create the ipbus 
   auto hw = uhal::ConnectionManager::getDevice(m_dal->UID(),
                                                m_dal->get_uri(),
                                                m_dal->get_address_table()->get_uri());    
   hw.setTimeoutPeriod(m_dal->get_timeout_ms());
 
+  m_strand.reset();
   m_core_controller = std::make_unique<HermesCoreController>(hw);
+  m_strand = std::make_unique<HermesCoreStrand>(*m_core_controller);
 
   const auto& core_info = m_core_controller->get_info();
   fmt::print("Hermes\n");
@@ -153,16 +238,18 @@ HermesModule::do_conf(const data_t& /*conf_as_json*/)
     }
   }
   // All good
-  for ( uint16_t i(0); i<core_info.n_mgt; ++i){
-    // Put the endpoint in a safe state
-    m_core_controller->enable(i, false);
-  }
-
-  m_core_controller->reset();
-
+  m_strand->submit(HermesCoreStrand::Priority::kCommand, [&](HermesCoreController::Batch& disable_batch) {
+    for ( uint16_t i(0); i<core_info.n_mgt; ++i){
+      // Put the endpoint in a safe state
+      m_core_controller->enable(disable_batch, i, false);
+    }
+  }).get();
 
   // FIXME: What the hell is this again?
   uint32_t filter_control = 0x07400307;
+
+  m_enabled_link_ids.clear();
+  std::vector<HermesCoreController::LinkConfig> desired;
   for( const auto& l : links) {
     if (l->disabled(*m_session)) {
       continue;  
@@ -170,17 +257,6 @@ HermesModule::do_conf(const data_t& /*conf_as_json*/)
 
     m_enabled_link_ids.push_back(l->get_link_id());
 
-    m_core_controller->config_udp(
-      l->get_link_id(),
-      ether_atou64(l->get_uses()->get_mac_address()),
-      ip_atou32(l->get_uses()->get_ip_address().at(0)),
-      l->get_port(),
-      ether_atou64(m_dal->get_destination()->get_mac_address()),
-      ip_atou32(m_dal->get_destination()->get_ip_address().at(0)),
-      l->get_port(),
-      filter_control
-    );
-
     // HermesDataSender may contains DetectorStreams or a ResourceSet
     // containing DetectorStreams. Just find the first DetectorStream
     // and use that for the geo id information.
@@ -206,29 +282,61 @@ HermesModule::do_conf(const data_t& /*conf_as_json*/)
       throw InvalidSourceStream(ERS_HERE, l->UID());
     }
 
-    m_core_controller->config_mux(
-      l->get_link_id(),
-      source->get_geo_id()->get_detector_id(),
-      source->get_geo_id()->get_crate_id(),
-      source->get_geo_id()->get_slot_id()
-    );
+    HermesCoreController::LinkConfig cfg;
+    cfg.link = l->get_link_id();
+    cfg.src_mac = ether_atou64(l->get_uses()->get_mac_address());
+    cfg.src_ip = ip_atou32(l->get_uses()->get_ip_address().at(0));
+    cfg.src_port = l->get_port();
+    cfg.dst_mac = ether_atou64(m_dal->get_destination()->get_mac_address());
+    cfg.dst_ip = ip_atou32(m_dal->get_destination()->get_ip_address().at(0));
+    cfg.dst_port = l->get_port();
+    cfg.filters = filter_control;
+    cfg.det = source->get_geo_id()->get_detector_id();
+    cfg.crate = source->get_geo_id()->get_crate_id();
+    cfg.slot = source->get_geo_id()->get_slot_id();
+    desired.push_back(cfg);
+  }
 
+  // Only the registers that differ are written, the core is reset only if
+  // the udp configuration has changed. A core with links in error is reset
+  // whatever its configuration, the reset clearing the error.
+  auto reset_duration = m_strand->run(HermesCoreStrand::Priority::kCommand, [this, &desired](HermesCoreController& ctrl) {
+    auto in_error = ctrl.read_links_in_error();
+    if ( !in_error.empty() ) {
+      TLOG() << get_name() << fmt::format(": links {} in error", fmt::join(in_error, ",")) << ", forcing a core reset";
+    }
+    bool force = !in_error.empty();
+    return ( ctrl.apply_link_configs(desired, force) ? std::optional(ctrl.get_last_reset_duration()) : std::nullopt );
+  }).get();
+
+  if ( reset_duration ) {
+    TLOG() << get_name() << ": links configured, core back " << reset_duration->count() << " us after reset";
+  } else {
+    TLOG() << get_name() << ": links configured without a reset";
   }
+
+  this->start_poller();
 }
 
 void
 HermesModule::do_start(const data_t& /*d*/)
 {
+  m_strand->submit(HermesCoreStrand::Priority::kCommand, [this](HermesCoreController::Batch& batch) {
+    for( auto id : m_enabled_link_ids) {
+      // Put the endpoint in a safe state
+      m_core_controller->enable(batch, id, true);
+    }
+  }).get();
 
-  for( auto id : m_enabled_link_ids) {
-    // Put the endpoint in a safe state
-    m_core_controller->enable(id, true);
-  }
 
+  // Links take some time to come up once enabled
+  auto readiness = m_strand->run(HermesCoreStrand::Priority::kCommand, [this](HermesCoreController& ctrl) {
+    std::vector<uint16_t> links(m_enabled_link_ids.begin(), m_enabled_link_ids.end());
+    return ctrl.wait_links_ready(links, s_link_ready_timeout);
+  }).get();
 
-  for( auto id : m_enabled_link_ids) {
-    // Put the endpoint in a safe state
-    m_core_controller->is_link_in_error(id, true);
+  for ( const auto& r : readiness ) {
+    TLOG() << get_name() << ": link " << r.link << " ready after " << r.time_to_ready.count() << " us";
   }
 
 
@@ -247,11 +355,12 @@ HermesModule::do_start(const data_t& /*d*/)
 void
 HermesModule::do_stop(const data_t& /*d*/)
 {
-
-  for( auto id : m_enabled_link_ids) {
-    // Put the endpoint in a safe state
-    m_core_controller->enable(id, false);
-  }
+  m_strand->submit(HermesCoreStrand::Priority::kCommand, [this](HermesCoreController::Batch& batch) {
+    for( auto id : m_enabled_link_ids) {
+      // Put the endpoint in a safe state
+      m_core_controller->enable(batch, id, false);
+    }
+  }).get();
 }
 
 } // namespace dunedaq::hermesmodules
@@ -14,10 +14,18 @@
 #include "appfwk/DAQModule.hpp"
 
 #include "hermesmodules/HermesCoreController.hpp"
+#include "hermesmodules/HermesCoreStrand.hpp"
 
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace dunedaq { 
 
@@ -39,6 +47,12 @@ ERS_DECLARE_ISSUE(hermesmodules,
                   ((uint16_t)link)
                   );
 
+ERS_DECLARE_ISSUE(hermesmodules,
+                  FailedToRetrieveLinksSnapshot,
+                  "Failed to retrieve hermes core stats snapshot for " << n_links << " links",
+                  ((uint16_t)n_links)
+                  );
+
 ERS_DECLARE_ISSUE(hermesmodules,
                   InvalidSourceStream,
                   "Configuration for " << what << " does not contain a detector stream",
@@ -79,7 +93,7 @@ public:
   HermesModule(HermesModule&&) = delete;
   HermesModule& operator=(HermesModule&&) = delete;
 
-  ~HermesModule() = default;
+  ~HermesModule();
 
 protected:
   void generate_opmon_data() override;
@@ -91,11 +105,41 @@ private:
   void do_start(const data_t&);
   void do_stop(const data_t&);
 
+  // Hardware poller: reads the core statistics on its own schedule,
+  // so that generate_opmon_data never blocks on IPbus transactions
+
+  // Everything generate_opmon_data publishes about the controller, so that
+  // it never touches the controller replaced by do_conf
+  struct HwSnapshot {
+    std::vector<HermesCoreController::LinkSnapshot> links;
+    opmon::DispatchInfo dispatch;
+    std::array<uint64_t, HermesCoreController::s_n_latency_buckets> dispatch_latency_hist;
+  };
+
+  static constexpr std::chrono::milliseconds s_poll_interval {1000};
+
+  // Deadline for the enabled links to report ready at start
+  static constexpr std::chrono::milliseconds s_link_ready_timeout {5000};
+
+  void start_poller();
+  void stop_poller();
+  void poll_hardware();
+
   std::unique_ptr<HermesCoreController> m_core_controller;
+  // All controller accesses go through the strand, declared after the controller it uses
+  std::unique_ptr<HermesCoreStrand> m_strand;
   const appmodel::HermesModule* m_dal;
   const confmodel::Session* m_session;
   std::vector<uint32_t> m_enabled_link_ids;
 
+  std::thread m_poller;
+  bool m_poller_running {false};
+  std::mutex m_poller_mutex;
+  std::condition_variable m_poller_cv;
+
+  // Latest snapshot, swapped atomically by the poller
+  std::shared_ptr<const HwSnapshot> m_snapshot;
+
   std::atomic<int64_t> m_total_amount {0};
   std::atomic<int>     m_amount_since_last_get_info_call {0};
 };
@@ -0,0 +1,61 @@
+/**
+ * @file hermesboardgroup.cpp
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "pybind11/chrono.h"
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+#include "hermesmodules/HermesBoardGroup.hpp"
+
+namespace py = pybind11;
+using namespace pybind11::literals;
+
+
+namespace dunedaq::hermesmodules::python {
+
+void
+register_hermesboardgroup(py::module& m)
+{
+    py::class_<HermesCoreController::LinkConfig>(m, "LinkConfig")
+    .def(py::init<>())
+    .def_readwrite("link", &HermesCoreController::LinkConfig::link)
+    .def_readwrite("src_mac", &HermesCoreController::LinkConfig::src_mac)
+    .def_readwrite("src_ip", &HermesCoreController::LinkConfig::src_ip)
+    .def_readwrite("src_port", &HermesCoreController::LinkConfig::src_port)
+    .def_readwrite("dst_mac", &HermesCoreController::LinkConfig::dst_mac)
+    .def_readwrite("dst_ip", &HermesCoreController::LinkConfig::dst_ip)
+    .def_readwrite("dst_port", &HermesCoreController::LinkConfig::dst_port)
+    .def_readwrite("filters", &HermesCoreController::LinkConfig::filters)
+    .def_readwrite("det", &HermesCoreController::LinkConfig::det)
+    .def_readwrite("crate", &HermesCoreController::LinkConfig::crate)
+    .def_readwrite("slot", &HermesCoreController::LinkConfig::slot)
+    .def_readwrite("use_external", &HermesCoreController::LinkConfig::use_external)
+    ;
+
+    py::class_<HermesBoardGroup::BoardResult>(m, "BoardResult")
+    .def_readonly("board", &HermesBoardGroup::BoardResult::board)
+    .def_readonly("ok", &HermesBoardGroup::BoardResult::ok)
+    .def_readonly("timed_out", &HermesBoardGroup::BoardResult::timed_out)
+    .def_readonly("error", &HermesBoardGroup::BoardResult::error)
+    .def_readonly("duration", &HermesBoardGroup::BoardResult::duration)
+    ;
+
+    // The operations block until every board is done or given up, the GIL is
+    // released meanwhile
+    py::class_<HermesBoardGroup>(m, "HermesBoardGroup")
+    .def(py::init<size_t>(), "max_threads"_a)
+    .def("add_board", &HermesBoardGroup::add_board, "name"_a, "hw"_a)
+    .def("get_board", &HermesBoardGroup::get_board, "name"_a, py::return_value_policy::reference_internal)
+    .def("get_boards", &HermesBoardGroup::get_boards)
+    .def("configure", &HermesBoardGroup::configure, "desired"_a, "timeout"_a, "force"_a = false, py::call_guard<py::gil_scoped_release>())
+    .def("start", &HermesBoardGroup::start, "links"_a, "timeout"_a, "ready_timeout"_a, py::call_guard<py::gil_scoped_release>())
+    .def("stop", &HermesBoardGroup::stop, "links"_a, "timeout"_a, py::call_guard<py::gil_scoped_release>())
+    ;
+}
+
+} // namespace dunedaq::hermesmodules::python
@@ -6,6 +6,7 @@
  * received with this code.
  */
 
+#include "pybind11/chrono.h"
 #include "pybind11/operators.h"
 #include "pybind11/pybind11.h"
 #include "pybind11/stl.h"
@@ -28,12 +29,15 @@ register_hermescorecontroller(py::module& m)
     // .def("load_hw_info", &HermesCoreController::load_hw_info)
     .def("sel_tx_mux", &HermesCoreController::sel_tx_mux)
     .def("sel_tx_mux_buf", &HermesCoreController::sel_tx_mux_buf)
-    .def("reset", &HermesCoreController::reset)
+    .def("sel_udp_core", &HermesCoreController::sel_udp_core)
+    .def("invalidate_selectors", &HermesCoreController::invalidate_selectors)
+    .def("reset", &HermesCoreController::reset, "nuke"_a = false, "links"_a = std::vector<uint16_t>(), "timeout"_a = HermesCoreController::s_reset_timeout, "wait_eth"_a = false)
+    .def("get_last_reset_duration", &HermesCoreController::get_last_reset_duration)
     .def("is_link_in_error", &HermesCoreController::is_link_in_error, "link"_a, "do_throw"_a = false)
-    .def("enable", &HermesCoreController::enable)
-    .def("config_mux", &HermesCoreController::config_mux)
-    .def("config_udp", &HermesCoreController::config_udp)
-    .def("config_fake_src", &HermesCoreController::config_fake_src)
+    .def("enable", py::overload_cast<uint16_t, bool>(&HermesCoreController::enable))
+    .def("config_mux", py::overload_cast<uint16_t, uint16_t, uint16_t, uint16_t>(&HermesCoreController::config_mux))
+    .def("config_udp", py::overload_cast<uint16_t, uint64_t, uint32_t, uint16_t, uint64_t, uint32_t, uint16_t, uint32_t>(&HermesCoreController::config_udp))
+    .def("config_fake_src", py::overload_cast<uint16_t, uint16_t, uint16_t, uint16_t>(&HermesCoreController::config_fake_src))
 
       //.def("read_link_stats", &HermesCoreController::read_link_stats)  //opmon
 
@@ -16,6 +16,9 @@ namespace dunedaq::hermesmodules::python {
 extern void
 register_hermescorecontroller(py::module&);
 
+extern void
+register_hermesboardgroup(py::module&);
+
 PYBIND11_MODULE(_daq_hermesmodules_py, m)
 {
 
@@ -25,6 +28,7 @@ PYBIND11_MODULE(_daq_hermesmodules_py, m)
   // you'd like to have a python binding to
 
   register_hermescorecontroller(m);
+  register_hermesboardgroup(m);
 }
 
 } // namespace dunedaq::hermesmodules::python
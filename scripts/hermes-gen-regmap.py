@@ -0,0 +1,114 @@
+#!/usr/bin/env python
+
+"""
+Generates a C++ header of constexpr register descriptors from a Hermes
+uhal address table, following the module="file://..." references.
+"""
+
+import argparse
+import keyword
+import os
+import re
+import xml.etree.ElementTree as ET
+
+FULL_MASK = 0xffffffff
+
+CXX_KEYWORDS = {
+    'and', 'auto', 'bool', 'break', 'case', 'char', 'class', 'const', 'continue',
+    'default', 'delete', 'do', 'double', 'else', 'enum', 'explicit', 'export',
+    'extern', 'false', 'float', 'for', 'friend', 'goto', 'if', 'inline', 'int',
+    'long', 'namespace', 'new', 'not', 'operator', 'or', 'private', 'protected',
+    'public', 'register', 'return', 'short', 'signed', 'sizeof', 'static',
+    'struct', 'switch', 'template', 'this', 'throw', 'true', 'try', 'typedef',
+    'union', 'unsigned', 'using', 'virtual', 'void', 'volatile', 'while', 'xor',
+}
+
+
+def cxx_name(node_id: str):
+    name = re.sub(r'\W', '_', node_id)
+    if name[0].isdigit() or name in CXX_KEYWORDS or keyword.iskeyword(name):
+        name = '_' + name
+    return name
+
+
+def load_node(path: str):
+    return ET.parse(path).getroot()
+
+
+def walk(xml_node, base_dir: str, base_addr: int):
+    """Returns a list of (id, address, mask, children) for the children of xml_node"""
+    entries = []
+    for child in xml_node.findall('node'):
+        node_id = child.get('id')
+        if node_id is None:
+            raise ValueError(f"Node without id found under '{xml_node.get('id')}'")
+
+        addr = base_addr + int(child.get('address', '0x0'), 0)
+        mask = int(child.get('mask', hex(FULL_MASK)), 0)
+
+        module = child.get('module')
+        if module:
+            module_path = os.path.join(base_dir, module.replace('file://', ''))
+            children = walk(load_node(module_path), os.path.dirname(module_path), addr)
+        else:
+            children = walk(child, base_dir, addr)
+
+        entries.append((node_id, addr, mask, children))
+    return entries
+
+
+def emit(entries, indent: int, lines: list):
+    pad = '  ' * indent
+    for node_id, addr, mask, children in entries:
+        name = cxx_name(node_id)
+        if children:
+            lines.append(f'{pad}namespace {name} {{')
+            lines.append(f'{pad}  inline constexpr Field node{{0x{addr:08x}, 0x{mask:08x}}};')
+            emit(children, indent+1, lines)
+            lines.append(f'{pad}}} // namespace {name}')
+        else:
+            lines.append(f'{pad}inline constexpr Field {name}{{0x{addr:08x}, 0x{mask:08x}}};')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('address_table', help='Top-level address table')
+    parser.add_argument('-o', '--output', required=True, help='Output header')
+    parser.add_argument('-n', '--namespace', default='regmap', help='Namespace of the generated map, inside dunedaq::hermesmodules')
+    args = parser.parse_args()
+
+    top_path = os.path.abspath(args.address_table)
+    entries = walk(load_node(top_path), os.path.dirname(top_path), 0)
+
+    table_name = os.path.join(os.path.basename(os.path.dirname(top_path)), os.path.basename(top_path))
+    guard = 'HERMESMODULES_INCLUDE_HERMESREGISTERMAP_HPP_'
+
+    lines = [
+        f'// Generated by hermes-gen-regmap.py from {table_name}. Do not edit.',
+        '',
+        f'#ifndef {guard}',
+        f'#define {guard}',
+        '',
+        '#include "hermesmodules/RegisterMap.hpp"',
+        '',
+        f'namespace dunedaq::hermesmodules::{args.namespace} {{',
+        '',
+        f'inline constexpr const char* address_table = "{table_name}";',
+        '',
+    ]
+    emit(entries, 0, lines)
+    lines += [
+        '',
+        f'}} // namespace dunedaq::hermesmodules::{args.namespace}',
+        '',
+        f'#endif /* {guard} */',
+        '',
+    ]
+
+    os.makedirs(os.path.dirname(os.path.abspath(args.output)), exist_ok=True)
+    with open(args.output, 'w') as f:
+        f.write('\n'.join(lines))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,241 @@
+#include "hermesmodules/BoardTaskPool.hpp"
+
+#include <algorithm>      // std::max
+#include <optional>
+#include <fmt/core.h>
+
+namespace dunedaq {
+namespace hermesmodules {
+
+struct BoardTaskPool::Gather {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<BoardResult> results;
+  std::vector<std::optional<std::chrono::steady_clock::time_point>> started;
+  // Set once the result of a board is final, either completed or given up
+  std::vector<bool> resolved;
+};
+
+
+//-----------------------------------------------------------------------------
+BoardTaskPool::BoardTaskPool(size_t max_threads) {
+
+  for ( size_t i(0); i<std::max<size_t>(max_threads, 1); ++i ) {
+    m_workers.emplace_back(&BoardTaskPool::worker, this);
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+BoardTaskPool::~BoardTaskPool() {
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+
+  // Tasks given up on are still running on the boards
+  for ( auto& w : m_workers ) {
+    w.join();
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+void
+BoardTaskPool::add_board(const std::string& name) {
+
+  if ( m_boards.count(name) ) {
+    throw BoardAlreadyInGroup(ERS_HERE, name);
+  }
+
+  m_boards.emplace(name, std::make_unique<Board>());
+}
+
+
+//-----------------------------------------------------------------------------
+bool
+BoardTaskPool::has_board(const std::string& name) const {
+  return m_boards.count(name) != 0;
+}
+
+
+//-----------------------------------------------------------------------------
+std::vector<std::string>
+BoardTaskPool::get_boards() const {
+
+  std::vector<std::string> names;
+  for ( const auto& [name, board] : m_boards ) {
+    names.push_back(name);
+  }
+  return names;
+}
+
+
+//-----------------------------------------------------------------------------
+std::vector<BoardTaskPool::BoardResult>
+BoardTaskPool::for_each(BoardFn fn, std::chrono::milliseconds timeout) {
+
+  auto gather = std::make_shared<Gather>();
+  gather->results.resize(m_boards.size());
+  gather->started.resize(m_boards.size());
+  gather->resolved.resize(m_boards.size(), false);
+
+  auto shared_fn = std::make_shared<const BoardFn>(std::move(fn));
+
+  std::vector<std::function<void()>> jobs;
+  size_t i(0);
+  for ( auto& [name, board] : m_boards ) {
+    gather->results[i].board = name;
+
+    if ( board->busy.exchange(true) ) {
+      gather->results[i].error = "busy with a task that timed out";
+      gather->resolved[i] = true;
+    } else {
+      jobs.push_back([this, gather, i, b = board.get(), shared_fn]() {
+        this->run_job(gather, i, *b, *shared_fn);
+      });
+    }
+    ++i;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for ( auto& job : jobs ) {
+      m_jobs.push_back(std::move(job));
+    }
+  }
+  m_cv.notify_all();
+
+  std::unique_lock<std::mutex> lock(gather->mutex);
+  while (true) {
+    auto now = std::chrono::steady_clock::now();
+    std::optional<std::chrono::steady_clock::time_point> next_deadline;
+    bool pending = false;
+    bool waiting = false;
+
+    for ( size_t j(0); j<gather->results.size(); ++j ) {
+      if ( gather->resolved[j] ) {
+        continue;
+      }
+
+      if ( !gather->started[j] ) {
+        pending = true;
+        waiting = true;
+        continue;
+      }
+
+      auto deadline = *gather->started[j] + timeout;
+      if ( deadline <= now ) {
+        auto& res = gather->results[j];
+        res.timed_out = true;
+        res.error = fmt::format("timed out after {} ms", timeout.count());
+        res.duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - *gather->started[j]);
+        gather->resolved[j] = true;
+        ++m_n_abandoned;
+      } else {
+        // Still running within its time
+        pending = true;
+        if ( !next_deadline || deadline < *next_deadline ) {
+          next_deadline = deadline;
+        }
+      }
+    }
+
+    if ( !pending ) {
+      break;
+    }
+
+    // No thread is left to run the boards still waiting, give them up too
+    if ( waiting && m_n_abandoned >= m_workers.size() ) {
+      for ( size_t j(0); j<gather->results.size(); ++j ) {
+        if ( !gather->resolved[j] && !gather->started[j] ) {
+          gather->results[j].error = "no thread available, all are busy with tasks that timed out";
+          gather->resolved[j] = true;
+        }
+      }
+      continue;
+    }
+
+    if ( next_deadline ) {
+      gather->cv.wait_until(lock, *next_deadline);
+    } else {
+      gather->cv.wait(lock);
+    }
+  }
+
+  return gather->results;
+}
+
+
+//-----------------------------------------------------------------------------
+void
+BoardTaskPool::run_job(const std::shared_ptr<Gather>& gather, size_t index, Board& board, const BoardFn& fn) {
+
+  auto start = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(gather->mutex);
+    // Given up before a thread became available
+    if ( gather->resolved[index] ) {
+      board.busy = false;
+      return;
+    }
+    gather->started[index] = start;
+  }
+  gather->cv.notify_all();
+
+  bool ok = false;
+  std::string error;
+  try {
+    fn(gather->results[index].board);
+    ok = true;
+  } catch ( const std::exception& e ) {
+    error = e.what();
+  } catch ( ... ) {
+    error = "unknown exception";
+  }
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+  {
+    std::lock_guard<std::mutex> lock(gather->mutex);
+    if ( gather->resolved[index] ) {
+      // The caller has already given up on this board
+      --m_n_abandoned;
+    } else {
+      auto& res = gather->results[index];
+      res.ok = ok;
+      res.error = error;
+      res.duration = duration;
+      gather->resolved[index] = true;
+    }
+  }
+  board.busy = false;
+  gather->cv.notify_all();
+}
+
+
+//-----------------------------------------------------------------------------
+void
+BoardTaskPool::worker() {
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while (true) {
+    m_cv.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+
+    if ( m_jobs.empty() ) {
+      return;
+    }
+
+    auto job = std::move(m_jobs.front());
+    m_jobs.pop_front();
+
+    lock.unlock();
+    job();
+    lock.lock();
+  }
+}
+
+}
+}
@@ -0,0 +1,142 @@
+#include "hermesmodules/HermesBoardGroup.hpp"
+
+namespace dunedaq {
+namespace hermesmodules {
+
+//-----------------------------------------------------------------------------
+HermesBoardGroup::HermesBoardGroup(size_t max_threads) :
+  m_pool(max_threads) {
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesBoardGroup::add_board(const std::string& name, uhal::HwInterface hw) {
+
+  if ( m_ctrls.count(name) ) {
+    throw BoardAlreadyInGroup(ERS_HERE, name);
+  }
+
+  m_ctrls.emplace(name, std::make_unique<HermesCoreController>(hw));
+  m_pool.add_board(name);
+}
+
+
+//-----------------------------------------------------------------------------
+HermesCoreController&
+HermesBoardGroup::get_board(const std::string& name) {
+
+  auto it = m_ctrls.find(name);
+  if ( it == m_ctrls.end() ) {
+    throw BoardNotInGroup(ERS_HERE, name);
+  }
+  return *it->second;
+}
+
+
+//-----------------------------------------------------------------------------
+std::vector<std::string>
+HermesBoardGroup::get_boards() const {
+  return m_pool.get_boards();
+}
+
+
+//-----------------------------------------------------------------------------
+std::vector<HermesBoardGroup::BoardResult>
+HermesBoardGroup::for_each(BoardFn fn, std::chrono::milliseconds timeout) {
+
+  return m_pool.for_each([this, fn = std::move(fn)](const std::string& name) {
+    fn(name, *m_ctrls.at(name));
+  }, timeout);
+}
+
+
+//-----------------------------------------------------------------------------
+template<typename T>
+void
+HermesBoardGroup::check_boards(const std::map<std::string, T>& args) const {
+
+  for ( const auto& [name, arg] : args ) {
+    if ( !m_pool.has_board(name) ) {
+      throw BoardNotInGroup(ERS_HERE, name);
+    }
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+std::vector<HermesBoardGroup::BoardResult>
+HermesBoardGroup::configure(const std::map<std::string, std::vector<HermesCoreController::LinkConfig>>& desired,
+                            std::chrono::milliseconds timeout,
+                            bool force) {
+
+  this->check_boards(desired);
+
+  auto configs = std::make_shared<const std::map<std::string, std::vector<HermesCoreController::LinkConfig>>>(desired);
+  return this->for_each([configs, force](const std::string& name, HermesCoreController& ctrl) {
+    auto it = configs->find(name);
+    if ( it == configs->end() ) {
+      return;
+    }
+
+    // Put the endpoints in a safe state
+    HermesCoreController::Batch batch(ctrl);
+    for ( uint16_t i(0); i<ctrl.get_info().n_mgt; ++i ) {
+      ctrl.enable(batch, i, false);
+    }
+    batch.dispatch();
+
+    ctrl.apply_link_configs(it->second, force);
+  }, timeout);
+}
+
+
+//-----------------------------------------------------------------------------
+std::vector<HermesBoardGroup::BoardResult>
+HermesBoardGroup::start(const std::map<std::string, std::vector<uint16_t>>& links,
+                        std::chrono::milliseconds timeout,
+                        std::chrono::milliseconds ready_timeout) {
+
+  this->check_boards(links);
+
+  auto board_links = std::make_shared<const std::map<std::string, std::vector<uint16_t>>>(links);
+  return this->for_each([board_links, ready_timeout](const std::string& name, HermesCoreController& ctrl) {
+    auto it = board_links->find(name);
+    if ( it == board_links->end() ) {
+      return;
+    }
+
+    HermesCoreController::Batch batch(ctrl);
+    for ( auto id : it->second ) {
+      ctrl.enable(batch, id, true);
+    }
+    batch.dispatch();
+
+    ctrl.wait_links_ready(it->second, ready_timeout);
+  }, timeout);
+}
+
+
+//-----------------------------------------------------------------------------
+std::vector<HermesBoardGroup::BoardResult>
+HermesBoardGroup::stop(const std::map<std::string, std::vector<uint16_t>>& links, std::chrono::milliseconds timeout) {
+
+  this->check_boards(links);
+
+  auto board_links = std::make_shared<const std::map<std::string, std::vector<uint16_t>>>(links);
+  return this->for_each([board_links](const std::string& name, HermesCoreController& ctrl) {
+    auto it = board_links->find(name);
+    if ( it == board_links->end() ) {
+      return;
+    }
+
+    HermesCoreController::Batch batch(ctrl);
+    for ( auto id : it->second ) {
+      ctrl.enable(batch, id, false);
+    }
+    batch.dispatch();
+  }, timeout);
+}
+
+}
+}
@@ -1,12 +1,33 @@
 #include "hermesmodules/HermesCoreController.hpp"
+#include "hermesmodules/RegisterMap.hpp"
 
+#include <algorithm>      // std::any_of, std::find, std::fill, std::min
 #include <chrono>         // std::chrono::seconds
 #include <thread>         // std::this_thread::sleep_for
 #include <fmt/core.h>
+#include <fmt/ranges.h>
 
 namespace dunedaq {
 namespace hermesmodules {
 
+namespace {
+
+// Sample timestamps count ticks of the 62.5 MHz DUNE timing clock
+constexpr double k_timestamp_clock_hz = 62.5e6;
+
+// Upper bound of the UDP core packet counters rate: minimum size frames
+// at 10 Gb/s, with a safety factor for host timing jitter
+constexpr double k_max_packet_rate = 2 * 14.88e6;
+
+// Extract a field from a block read starting at the base node address
+uint32_t
+block_field(const uhal::ValVector<uint32_t>& block, const uhal::Node& base, const uhal::Node& field) {
+  uint32_t word = block.at(field.getAddress() - base.getAddress());
+  return (word & field.getMask()) >> regmap::mask_shift(field.getMask());
+}
+
+} // namespace
+
 //-----------------------------------------------------------------------------
 HermesCoreController::HermesCoreController(uhal::HwInterface hw, std::string readout_id) :
   m_hw(hw), m_readout(m_hw.getNode(readout_id)) {
@@ -26,7 +47,7 @@ HermesCoreController::load_hw_info() {
 
   // Check magic number
   auto magic = m_readout.getNode("info.magic").read();
-  m_readout.getClient().dispatch();
+  this->dispatch();
   if (magic.value() != 0xdeadbeef){
       // TODO: add ERS exception
       throw MagicNumberError(ERS_HERE, magic.value(),0xdeadbeef);
@@ -42,7 +63,7 @@ HermesCoreController::load_hw_info() {
   auto n_mgt = m_readout.getNode("info.generics.n_mgts").read();
   auto n_src = m_readout.getNode("info.generics.n_srcs").read();
   auto ref_freq = m_readout.getNode("info.generics.ref_freq").read();
-  m_readout.getClient().dispatch();
+  this->dispatch();
 
   // Version
   m_core_info.design = design.value();
@@ -58,6 +79,91 @@ HermesCoreController::load_hw_info() {
   // Extra info
   m_core_info.srcs_per_mux = m_core_info.n_src/m_core_info.n_mgt;
 
+  m_tx_mux_buf_sel.assign(m_core_info.n_mgt, std::nullopt);
+  m_link_counters.assign(m_core_info.n_mgt, LinkCounters());
+  m_link_time_to_ready.assign(m_core_info.n_mgt, std::chrono::microseconds(0));
+
+  // Resolve all the nodes used by the controller upfront:
+  // missing nodes are reported here rather than at first use
+  auto node = [this](const std::string& id) { return &m_readout.getNode(id); };
+
+  m_regs.nuke = node("csr.ctrl.nuke");
+  m_regs.soft_rst = node("csr.ctrl.soft_rst");
+
+  // The counter sampling block is not available in older firmware versions
+  auto node_ids = m_readout.getNodes();
+  bool has_samp = (std::find(node_ids.begin(), node_ids.end(), "samp.ctrl.samp") != node_ids.end());
+  m_regs.samp = (has_samp ? node("samp.ctrl.samp") : nullptr);
+  m_regs.samp_ts = (has_samp ? Counter64{node("samp.samp_ts_l"), node("samp.samp_ts_h")} : Counter64{nullptr, nullptr});
+
+  // Same for the PCS/PMA debug block
+  bool has_pcs_pma = (std::find(node_ids.begin(), node_ids.end(), "pcs_pma.debug.csr.stat.rx_status") != node_ids.end());
+  m_regs.pcs_pma_rx_status = (has_pcs_pma ? node("pcs_pma.debug.csr.stat.rx_status") : nullptr);
+  m_regs.pcs_pma_tx_status = (has_pcs_pma ? node("pcs_pma.debug.csr.stat.tx_status") : nullptr);
+
+  m_regs.tx_mux_sel = node("tx_path.csr_tx_mux.ctrl.tx_mux_sel");
+  m_regs.udp_core_sel = node("tx_path.csr_udp_core.ctrl.udp_core_sel");
+
+  m_regs.tx_mux_en = node("tx_path.tx_mux.csr.ctrl.en");
+  m_regs.tx_mux_en_buf = node("tx_path.tx_mux.csr.ctrl.en_buf");
+  m_regs.tx_mux_tx_en = node("tx_path.tx_mux.csr.ctrl.tx_en");
+  m_regs.tx_mux_sel_buf = node("tx_path.tx_mux.csr.ctrl.sel_buf");
+
+  m_regs.tx_mux_stat = node("tx_path.tx_mux.csr.stat");
+  m_regs.tx_mux_err = node("tx_path.tx_mux.csr.stat.err");
+  m_regs.tx_mux_eth_rdy = node("tx_path.tx_mux.csr.stat.eth_rdy");
+  m_regs.tx_mux_src_rdy = node("tx_path.tx_mux.csr.stat.src_rdy");
+  m_regs.tx_mux_udp_rdy = node("tx_path.tx_mux.csr.stat.udp_rdy");
+
+  m_regs.mux_detid = node("tx_path.tx_mux.mux.ctrl.detid");
+  m_regs.mux_crate = node("tx_path.tx_mux.mux.ctrl.crate");
+  m_regs.mux_slot = node("tx_path.tx_mux.mux.ctrl.slot");
+
+  m_regs.buf_fake_en = node("tx_path.tx_mux.buf.ctrl.fake_en");
+  m_regs.buf_dlen = node("tx_path.tx_mux.buf.ctrl.dlen");
+  m_regs.buf_rate_rdx = node("tx_path.tx_mux.buf.ctrl.rate_rdx");
+
+  const auto& udp_ctrl = m_readout.getNode("tx_path.udp_core.udp_core_control");
+  m_regs.udp_use_external = &udp_ctrl.getNode("src_addr_ctrl.use_external");
+  m_regs.udp_src_mac_lower = &udp_ctrl.getNode("src_addr_ctrl.src_mac_addr_lower");
+  m_regs.udp_src_mac_upper = &udp_ctrl.getNode("src_addr_ctrl.src_mac_addr_upper");
+  m_regs.udp_src_ip = &udp_ctrl.getNode("src_addr_ctrl.src_ip_addr");
+  m_regs.udp_src_port = &udp_ctrl.getNode("src_addr_ctrl.src_port");
+  m_regs.udp_dst_mac_lower = &udp_ctrl.getNode("ctrl.dst_mac_addr_lower");
+  m_regs.udp_dst_mac_upper = &udp_ctrl.getNode("ctrl.dst_mac_addr_upper");
+  m_regs.udp_dst_ip = &udp_ctrl.getNode("ctrl.dst_ip_addr");
+  m_regs.udp_dst_port = &udp_ctrl.getNode("ctrl.dst_port");
+  m_regs.udp_filter_control = &udp_ctrl.getNode("ctrl.filter_control");
+
+  m_regs.rx_arp_count = &udp_ctrl.getNode("rx_packet_counters.arp_count");
+  m_regs.rx_ping_count = &udp_ctrl.getNode("rx_packet_counters.ping_count");
+  m_regs.rx_udp_count = &udp_ctrl.getNode("rx_packet_counters.udp_count");
+  m_regs.tx_arp_count = &udp_ctrl.getNode("tx_packet_counters.arp_count");
+  m_regs.tx_ping_count = &udp_ctrl.getNode("tx_packet_counters.ping_count");
+  m_regs.tx_udp_count = &udp_ctrl.getNode("tx_packet_counters.udp_count");
+
+  const auto& buf = m_readout.getNode("tx_path.tx_mux.buf");
+  auto counter = [&buf](const std::string& id) -> Counter64 {
+    return { &buf.getNode(id + "_l"), &buf.getNode(id + "_h") };
+  };
+  m_regs.buf_stat = &buf.getNode("stat");
+  m_regs.buf_rx_stat = &buf.getNode("stat.rx_stat");
+  m_regs.buf_tx_stat = &buf.getNode("stat.tx_stat");
+  m_regs.buf_lwm = &buf.getNode("buf_mon.lwm");
+  m_regs.buf_hwm = &buf.getNode("buf_mon.hwm");
+  m_regs.buf_llwm = &buf.getNode("buf_mon.llwm");
+  m_regs.buf_lhwm = &buf.getNode("buf_mon.lhwm");
+  m_regs.buf_ts = counter("ts");
+  m_regs.buf_vol = counter("vol");
+  m_regs.buf_blk_acc = counter("blk_acc");
+  m_regs.buf_blk_rej = counter("blk_rej");
+  m_regs.buf_blk_oflow = counter("blk_oflow");
+  m_regs.buf_blk_longlast = counter("blk_longlast");
+  m_regs.buf_blk_lastnotval = counter("blk_lastnotval");
+
+  // The block spans from buf.stat to the last counter register
+  m_regs.buf_block_size = m_regs.buf_blk_lastnotval.hi->getAddress() - m_regs.buf_stat->getAddress() + 1;
+
   fmt::print("Number of links: {}\n", m_core_info.n_mgt);
   fmt::print("Number of sources: {}\n", m_core_info.n_src);
   fmt::print("Reference freq: {}\n", m_core_info.ref_freq);
@@ -66,65 +172,396 @@ HermesCoreController::load_hw_info() {
 
 //-----------------------------------------------------------------------------
 void
-HermesCoreController::sel_tx_mux(uint16_t i) {
-  if ( i >= m_core_info.n_mgt ) {
+HermesCoreController::dispatch() {
+
+  auto start = std::chrono::steady_clock::now();
+  try {
+    m_readout.getClient().dispatch();
+  } catch ( const uhal::exception::exception& ) {
+    ++m_n_failed_dispatches;
+    throw;
+  }
+  uint64_t elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+  ++m_n_dispatches;
+  m_dispatch_time_us += elapsed_us;
+
+  uint64_t max_us = m_max_dispatch_time_us.load();
+  while ( elapsed_us > max_us && !m_max_dispatch_time_us.compare_exchange_weak(max_us, elapsed_us) ) {}
+
+  // Index of the first power of 2 above the latency
+  size_t bucket = (elapsed_us ? 64 - __builtin_clzll(elapsed_us) : 0);
+  ++m_dispatch_latency_hist[std::min(bucket, s_n_latency_buckets-1)];
+}
+
+
+//-----------------------------------------------------------------------------
+opmon::DispatchInfo
+HermesCoreController::get_dispatch_info() {
+
+  opmon::DispatchInfo info;
+  info.set_n_dispatches(m_n_dispatches.load());
+  info.set_n_failed_dispatches(m_n_failed_dispatches.load());
+  info.set_total_time_us(m_dispatch_time_us.load());
+  info.set_max_time_us(m_max_dispatch_time_us.exchange(0));
+  return info;
+}
+
+
+//-----------------------------------------------------------------------------
+std::array<uint64_t, HermesCoreController::s_n_latency_buckets>
+HermesCoreController::get_dispatch_latency_histogram() const {
+
+  std::array<uint64_t, s_n_latency_buckets> hist;
+  for ( size_t i(0); i<s_n_latency_buckets; ++i ) {
+    hist[i] = m_dispatch_latency_hist[i].load();
+  }
+  return hist;
+}
+
+
+//-----------------------------------------------------------------------------
+HermesCoreController::Batch::Batch(HermesCoreController& ctrl) :
+  m_ctrl(ctrl) {
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::Batch::write(const uhal::Node& node, uint32_t value) {
+  if ( !m_staging ) {
+    node.write(value);
+    return;
+  }
+
+  this->check_access(node, uhal::defs::WRITE);
+  uint32_t mask = node.getMask();
+  if ( mask != uhal::defs::NOMASK && (value & ~(mask >> regmap::mask_shift(mask))) ) {
+    throw InvalidRegisterAccess(ERS_HERE, node.getPath(), fmt::format("value 0x{:x} does not fit in mask 0x{:x}", value, mask));
+  }
+  m_staged.push_back([&node, value]() { node.write(value); });
+}
+
+
+//-----------------------------------------------------------------------------
+uhal::ValWord<uint32_t>
+HermesCoreController::Batch::read(const uhal::Node& node) {
+  if ( !m_staging ) {
+    return node.read();
+  }
+
+  this->check_access(node, uhal::defs::READ);
+  uhal::ValWord<uint32_t> value;
+  m_staged.push_back([this, &node, value]() { m_staged_words.emplace_back(node.read(), value); });
+  return value;
+}
+
+
+//-----------------------------------------------------------------------------
+uhal::ValVector<uint32_t>
+HermesCoreController::Batch::read_block(const uhal::Node& node, uint32_t size) {
+  // Plain register nodes do not allow block reads, go through the client
+  if ( !m_staging ) {
+    return node.getClient().readBlock(node.getAddress(), size, uhal::defs::INCREMENTAL);
+  }
+
+  uhal::ValVector<uint32_t> block;
+  m_staged.push_back([this, &node, size, block]() {
+    m_staged_blocks.emplace_back(node.getClient().readBlock(node.getAddress(), size, uhal::defs::INCREMENTAL), block);
+  });
+  return block;
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::Batch::check_access(const uhal::Node& node, uint32_t permission) const {
+  if ( !(node.getPermission() & permission) ) {
+    throw InvalidRegisterAccess(ERS_HERE, node.getPath(), (permission == uhal::defs::WRITE ? "not writable" : "not readable"));
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::Batch::stage() {
+  this->commit_staged();
+
+  m_staging = true;
+  m_saved_tx_mux_sel = m_ctrl.m_tx_mux_sel;
+  m_saved_udp_core_sel = m_ctrl.m_udp_core_sel;
+  m_saved_tx_mux_buf_sel = m_ctrl.m_tx_mux_buf_sel;
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::Batch::commit_staged() {
+  m_staging = false;
+  for ( auto& queue : m_staged ) {
+    queue();
+  }
+  m_staged.clear();
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::Batch::drop_staged() {
+  if ( !m_staging ) {
+    return;
+  }
+
+  m_staging = false;
+  m_staged.clear();
+  m_ctrl.m_tx_mux_sel = m_saved_tx_mux_sel;
+  m_ctrl.m_udp_core_sel = m_saved_udp_core_sel;
+  m_ctrl.m_tx_mux_buf_sel = m_saved_tx_mux_buf_sel;
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::Batch::sel_tx_mux(uint16_t i) {
+  if ( i >= m_ctrl.m_core_info.n_mgt ) {
     throw LinkDoesNotExist(ERS_HERE, i);
   }
 
-  m_readout.getNode("tx_path.csr_tx_mux.ctrl.tx_mux_sel").write(i);
-  m_readout.getClient().dispatch();
+  if ( m_ctrl.m_tx_mux_sel == i ) {
+    return;
+  }
+
+  this->write(*m_ctrl.m_regs.tx_mux_sel, i);
+  m_ctrl.m_tx_mux_sel = i;
 }
 
 
 //-----------------------------------------------------------------------------
 void
-HermesCoreController::sel_tx_mux_buf(uint16_t i) {
-  if ( i >= m_core_info.n_src ) {
+HermesCoreController::Batch::sel_tx_mux_buf(uint16_t i) {
+  if ( i >= m_ctrl.m_core_info.n_src ) {
     throw InputBufferDoesNotExist(ERS_HERE, i);
   }
 
-  m_readout.getNode("tx_path.tx_mux.csr.ctrl.sel_buf").write(i);
-  m_readout.getClient().dispatch();
+  // The buffer selector belongs to the currently selected tx_mux
+  if ( !m_ctrl.m_tx_mux_sel ) {
+    this->write(*m_ctrl.m_regs.tx_mux_sel_buf, i);
+    return;
+  }
+
+  auto& buf_sel = m_ctrl.m_tx_mux_buf_sel.at(*m_ctrl.m_tx_mux_sel);
+  if ( buf_sel == i ) {
+    return;
+  }
+
+  this->write(*m_ctrl.m_regs.tx_mux_sel_buf, i);
+  buf_sel = i;
 }
 
 
 //-----------------------------------------------------------------------------
 void
-HermesCoreController::sel_udp_core(uint16_t i) {
-  if ( i >= m_core_info.n_src ) {
+HermesCoreController::Batch::sel_udp_core(uint16_t i) {
+  if ( i >= m_ctrl.m_core_info.n_src ) {
     throw InputBufferDoesNotExist(ERS_HERE, i);
   }
 
-  m_readout.getNode("tx_path.csr_udp_core.ctrl.udp_core_sel").write(i);
-  m_readout.getClient().dispatch();
+  if ( m_ctrl.m_udp_core_sel == i ) {
+    return;
+  }
+
+  this->write(*m_ctrl.m_regs.udp_core_sel, i);
+  m_ctrl.m_udp_core_sel = i;
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::Batch::dispatch() {
+  this->commit_staged();
+
+  try {
+    m_ctrl.dispatch();
+  } catch ( const uhal::exception::exception& ) {
+    // The state of the selectors is unknown after a failed transaction,
+    // the values of the staged reads are left invalid
+    m_staged_words.clear();
+    m_staged_blocks.clear();
+    m_ctrl.invalidate_selectors();
+    throw;
+  }
+
+  for ( auto& [read, value] : m_staged_words ) {
+    value.value(read.value());
+    value.valid(true);
+  }
+  for ( auto& [read, block] : m_staged_blocks ) {
+    for ( auto word : read ) {
+      block.push_back(word);
+    }
+    block.valid(true);
+  }
+  m_staged_words.clear();
+  m_staged_blocks.clear();
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::sel_tx_mux(uint16_t i) {
+  Batch batch(*this);
+  batch.sel_tx_mux(i);
+  batch.dispatch();
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::sel_tx_mux_buf(uint16_t i) {
+  Batch batch(*this);
+  batch.sel_tx_mux_buf(i);
+  batch.dispatch();
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::sel_udp_core(uint16_t i) {
+  Batch batch(*this);
+  batch.sel_udp_core(i);
+  batch.dispatch();
 }
 
 
 //-----------------------------------------------------------------------------
 void
-HermesCoreController::reset(bool nuke) {
+HermesCoreController::invalidate_selectors() {
+  m_tx_mux_sel.reset();
+  m_udp_core_sel.reset();
+  std::fill(m_tx_mux_buf_sel.begin(), m_tx_mux_buf_sel.end(), std::nullopt);
+}
 
-    if (nuke) {
-        m_readout.getNode("csr.ctrl.nuke").write(0x1);
-        m_readout.getClient().dispatch();
 
-        // time.sleep(0.1);
-        std::this_thread::sleep_for (std::chrono::milliseconds(1));
+//-----------------------------------------------------------------------------
+std::chrono::microseconds
+HermesCoreController::reset(bool nuke, const std::vector<uint16_t>& links, std::chrono::milliseconds timeout, bool wait_eth) {
 
-        m_readout.getNode("csr.ctrl.nuke").write(0x0);
-        m_readout.getClient().dispatch();
+  const std::vector<uint16_t>& wait_links(links);
+  for ( auto link : wait_links ) {
+    if ( link >= m_core_info.n_mgt ) {
+      throw LinkDoesNotExist(ERS_HERE, link);
     }
-    
-    m_readout.getNode("csr.ctrl.soft_rst").write(0x1);
-    m_readout.getClient().dispatch();
+  }
 
-    // time.sleep(0.1)
-    std::this_thread::sleep_for (std::chrono::milliseconds(1));
+  // Selectors and counters are cleared by the reset
+  this->invalidate_selectors();
+  m_last_sample.reset();
+  for ( auto& c : m_link_counters ) {
+    c.rcvd_arp.rebase();
+    c.rcvd_ping.rebase();
+    c.rcvd_udp.rebase();
+    c.sent_arp.rebase();
+    c.sent_ping.rebase();
+    c.sent_udp.rebase();
+  }
+  std::fill(m_link_time_to_ready.begin(), m_link_time_to_ready.end(), std::chrono::microseconds(0));
 
+  // Each bit is released once it has been held for the minimum pulse width
+  auto pulse = [this](const uhal::Node& bit) {
+    Batch assert_bit(*this);
+    assert_bit.write(bit, 0x1);
+    assert_bit.dispatch();
 
-    m_readout.getNode("csr.ctrl.soft_rst").write(0x0);
-    m_readout.getClient().dispatch();
+    std::this_thread::sleep_for(s_reset_pulse_width);
+
+    Batch release_bit(*this);
+    release_bit.write(bit, 0x0);
+    release_bit.dispatch();
+  };
+
+  if (nuke) {
+    pulse(*m_regs.nuke);
+  }
+  pulse(*m_regs.soft_rst);
+
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + timeout;
+  auto interval = s_ready_poll_min;
+
+  // Nothing to wait for, the core is taken as back once the bits are released
+  if ( wait_links.empty() || (!m_regs.pcs_pma_rx_status && !wait_eth) ) {
+    m_last_reset_duration = std::chrono::microseconds(0);
+    return m_last_reset_duration;
+  }
+
+  // The PCS/PMA status carries one bit per MGT, only those of the links
+  // waited for are checked
+  uint32_t mgt_mask = 0;
+  if ( m_regs.pcs_pma_rx_status ) {
+    uint32_t field_mask = m_regs.pcs_pma_rx_status->getMask();
+    for ( auto link : wait_links ) {
+      mgt_mask |= uint32_t(1ull << link);
+    }
+    mgt_mask &= field_mask >> regmap::mask_shift(field_mask);
+  }
+
+  // Without wait_eth the ethernet of the links is taken as ready
+  std::vector<bool> eth_ready(wait_links.size(), !wait_eth);
+  while (true) {
+    Batch batch(*this);
+
+    uhal::ValWord<uint32_t> rx_status, tx_status;
+    if ( m_regs.pcs_pma_rx_status ) {
+      rx_status = batch.read(*m_regs.pcs_pma_rx_status);
+      tx_status = batch.read(*m_regs.pcs_pma_tx_status);
+    }
 
+    std::vector<std::pair<size_t, uhal::ValWord<uint32_t>>> eth_rdy;
+    for ( size_t i(0); i<wait_links.size(); ++i ) {
+      if ( eth_ready[i] ) {
+        continue;
+      }
+      batch.sel_tx_mux(wait_links[i]);
+      eth_rdy.emplace_back(i, batch.read(*m_regs.tx_mux_eth_rdy));
+    }
+    batch.dispatch();
+
+    auto now = std::chrono::steady_clock::now();
+
+    bool pcs_pma_ready = true;
+    if ( m_regs.pcs_pma_rx_status ) {
+      pcs_pma_ready = ((rx_status.value() & mgt_mask) == mgt_mask) && ((tx_status.value() & mgt_mask) == mgt_mask);
+    }
+
+    std::vector<uint16_t> not_ready;
+    for ( const auto& [i, rdy] : eth_rdy ) {
+      eth_ready[i] = rdy.value();
+      if ( !eth_ready[i] ) {
+        not_ready.push_back(wait_links[i]);
+      }
+    }
+
+    if ( pcs_pma_ready && not_ready.empty() ) {
+      m_last_reset_duration = std::chrono::duration_cast<std::chrono::microseconds>(now - start);
+      break;
+    }
+
+    if ( now >= deadline ) {
+      std::string reason;
+      if ( !pcs_pma_ready ) {
+        reason += fmt::format("pcs_pma rx_status 0x{:x}, tx_status 0x{:x}; ", rx_status.value(), tx_status.value());
+      }
+      if ( !not_ready.empty() ) {
+        reason += fmt::format("eth not ready on links {}", fmt::join(not_ready, ","));
+      }
+      throw CoreNotReadyAfterReset(ERS_HERE, timeout.count(), reason);
+    }
+
+    std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(interval, deadline - now));
+    interval = std::min(interval * 2, s_ready_poll_max);
+  }
+
+  return m_last_reset_duration;
 }
 
 
@@ -132,14 +569,14 @@ HermesCoreController::reset(bool nuke) {
 bool
 HermesCoreController::is_link_in_error(uint16_t link, bool do_throw) {
 
-  this->sel_tx_mux(link);
+  Batch batch(*this);
+  batch.sel_tx_mux(link);
 
-  auto& tx_mux_stat = m_readout.getNode("tx_path.tx_mux.csr.stat");
-  auto err = tx_mux_stat.getNode("err").read();
-  auto eth_rdy = tx_mux_stat.getNode("eth_rdy").read();
-  auto src_rdy = tx_mux_stat.getNode("src_rdy").read();
-  auto udp_rdy = tx_mux_stat.getNode("udp_rdy").read();
-  tx_mux_stat.getClient().dispatch();
+  auto err = batch.read(*m_regs.tx_mux_err);
+  auto eth_rdy = batch.read(*m_regs.tx_mux_eth_rdy);
+  auto src_rdy = batch.read(*m_regs.tx_mux_src_rdy);
+  auto udp_rdy = batch.read(*m_regs.tx_mux_udp_rdy);
+  batch.dispatch();
 
   bool is_error = (err || !eth_rdy || !src_rdy || !udp_rdy);
 
@@ -150,49 +587,123 @@ HermesCoreController::is_link_in_error(uint16_t link, bool do_throw) {
   return is_error;
 }
 
+//-----------------------------------------------------------------------------
+std::vector<HermesCoreController::LinkReadiness>
+HermesCoreController::wait_links_ready(const std::vector<uint16_t>& links, std::chrono::milliseconds timeout, bool do_throw) {
+
+  for ( auto link : links ) {
+    if ( link >= m_core_info.n_mgt ) {
+      throw LinkDoesNotExist(ERS_HERE, link);
+    }
+  }
+
+  // The status bits are decoded from a single read of the stat register
+  auto bit = [](uint32_t stat, const uhal::Node* node) {
+    return bool(stat & node->getMask());
+  };
+  auto is_ready = [&](uint32_t stat) {
+    return !bit(stat, m_regs.tx_mux_err) && bit(stat, m_regs.tx_mux_eth_rdy) && bit(stat, m_regs.tx_mux_src_rdy) && bit(stat, m_regs.tx_mux_udp_rdy);
+  };
+
+  std::vector<LinkReadiness> readiness;
+  for ( auto link : links ) {
+    readiness.push_back({link, false, std::chrono::microseconds(0)});
+  }
+  std::vector<uint32_t> last_stat(links.size(), 0);
+
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + timeout;
+  auto interval = s_ready_poll_min;
+
+  while (true) {
+    Batch batch(*this);
+    std::vector<std::pair<size_t, uhal::ValWord<uint32_t>>> stats;
+    for ( size_t i(0); i<readiness.size(); ++i ) {
+      if ( readiness[i].ready ) {
+        continue;
+      }
+      batch.sel_tx_mux(readiness[i].link);
+      stats.emplace_back(i, batch.read(*m_regs.tx_mux_stat));
+    }
+    batch.dispatch();
+
+    auto now = std::chrono::steady_clock::now();
+    bool all_ready = true;
+    for ( const auto& [i, stat] : stats ) {
+      last_stat[i] = stat.value();
+      if ( is_ready(last_stat[i]) ) {
+        readiness[i].ready = true;
+        readiness[i].time_to_ready = std::chrono::duration_cast<std::chrono::microseconds>(now - start);
+        m_link_time_to_ready.at(readiness[i].link) = readiness[i].time_to_ready;
+      } else {
+        all_ready = false;
+      }
+    }
+
+    if ( all_ready ) {
+      break;
+    }
+
+    if ( now >= deadline ) {
+      if ( do_throw ) {
+        for ( size_t i(0); i<readiness.size(); ++i ) {
+          if ( !readiness[i].ready ) {
+            uint32_t stat = last_stat[i];
+            throw LinkInError(ERS_HERE, readiness[i].link, bit(stat, m_regs.tx_mux_err), bit(stat, m_regs.tx_mux_eth_rdy), bit(stat, m_regs.tx_mux_src_rdy), bit(stat, m_regs.tx_mux_udp_rdy));
+          }
+        }
+      }
+      break;
+    }
+
+    std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(interval, deadline - now));
+    interval = std::min(interval * 2, s_ready_poll_max);
+  }
+
+  return readiness;
+}
+
+
 //-----------------------------------------------------------------------------
 void
 HermesCoreController::enable(uint16_t link, bool enable) {
+  Batch batch(*this);
+  this->enable(batch, link, enable);
+  batch.dispatch();
+}
 
-  this->sel_tx_mux(link);
 
-  auto& tx_mux_ctrl = m_readout.getNode("tx_path.tx_mux.csr.ctrl");
-  
-  // Not sure what to do with this
-  auto tx_en = tx_mux_ctrl.getNode("tx_en").read();
-  auto buf_en = tx_mux_ctrl.getNode("en_buf").read();
-  auto ctrl_en = tx_mux_ctrl.getNode("en").read();
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::enable(Batch& batch, uint16_t link, bool enable) {
 
+  batch.sel_tx_mux(link);
+
+  // Transactions in a batch are executed in order, the firmware sees
+  // the same enable/disable sequence as with separate dispatches
   if ( enable ) {
 
     // Assume that all is off
 
     // Enable the main logic
-    tx_mux_ctrl.getNode("en").write(0x1);
-    tx_mux_ctrl.getClient().dispatch();
+    batch.write(*m_regs.tx_mux_en, 0x1);
 
     // Enable transmitter first
-    tx_mux_ctrl.getNode("tx_en").write(0x1);
-    tx_mux_ctrl.getClient().dispatch();
+    batch.write(*m_regs.tx_mux_tx_en, 0x1);
 
     // Enable buffers last
-    tx_mux_ctrl.getNode("en_buf").write(0x1);
-    tx_mux_ctrl.getClient().dispatch();
-
+    batch.write(*m_regs.tx_mux_en_buf, 0x1);
 
   } else {
 
     // Disable buffers last
-    tx_mux_ctrl.getNode("en_buf").write(0x0);
-    tx_mux_ctrl.getClient().dispatch();
+    batch.write(*m_regs.tx_mux_en_buf, 0x0);
 
     // Disable transmitter first
-    tx_mux_ctrl.getNode("tx_en").write(0x0);
-    tx_mux_ctrl.getClient().dispatch();
+    batch.write(*m_regs.tx_mux_tx_en, 0x0);
 
     // Disable the main logic
-    tx_mux_ctrl.getNode("en").write(0x0);
-    tx_mux_ctrl.getClient().dispatch();
+    batch.write(*m_regs.tx_mux_en, 0x0);
 
   }
 
@@ -202,56 +713,66 @@ HermesCoreController::enable(uint16_t link, bool enable) {
 //-----------------------------------------------------------------------------
 void
 HermesCoreController::config_mux(uint16_t link, uint16_t det, uint16_t crate, uint16_t slot) {
-  this->sel_tx_mux(link);
+  Batch batch(*this);
+  this->config_mux(batch, link, det, crate, slot);
+  batch.dispatch();
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::config_mux(Batch& batch, uint16_t link, uint16_t det, uint16_t crate, uint16_t slot) {
 
+  batch.sel_tx_mux(link);
 
-  auto& mux_ctrl = m_readout.getNode("tx_path.tx_mux.mux.ctrl");
+  batch.write(*m_regs.mux_detid, det);
+  batch.write(*m_regs.mux_crate, crate);
+  batch.write(*m_regs.mux_slot, slot);
 
-  mux_ctrl.getNode("detid").write(det);
-  mux_ctrl.getNode("crate").write(crate);
-  mux_ctrl.getNode("slot").write(slot);
-  mux_ctrl.getClient().dispatch();
-    
 }
 
 
 //-----------------------------------------------------------------------------
 void
 HermesCoreController::config_udp( uint16_t link, uint64_t src_mac, uint32_t src_ip, uint16_t src_port, uint64_t dst_mac, uint32_t dst_ip, uint16_t dst_port, uint32_t filters) {
+  Batch batch(*this);
+  this->config_udp(batch, link, src_mac, src_ip, src_port, dst_mac, dst_ip, dst_port, filters);
+  batch.dispatch();
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::config_udp( Batch& batch, uint16_t link, uint64_t src_mac, uint32_t src_ip, uint16_t src_port, uint64_t dst_mac, uint32_t dst_ip, uint16_t dst_port, uint32_t filters) {
 
   if ( link >= m_core_info.n_mgt ) {
     throw LinkDoesNotExist(ERS_HERE, link);
   }
 
-  this->sel_udp_core(link);
+  batch.sel_udp_core(link);
 
-  // const std::string udp_ctrl_name = fmt::format("udp.udp_core_{}.udp_core_control.nz_rst_ctrl");
-  const auto& udp_ctrl = m_readout.getNode("tx_path.udp_core.udp_core_control");
-
-
-  udp_ctrl.getNode("src_addr_ctrl.use_external").write(0);  
+  batch.write(*m_regs.udp_use_external, 0);
 
   // Load the source mac address
-  udp_ctrl.getNode("src_addr_ctrl.src_mac_addr_lower").write(src_mac & 0xffffffff);
-  udp_ctrl.getNode("src_addr_ctrl.src_mac_addr_upper").write((src_mac >> 32) & 0xffff);
+  batch.write(*m_regs.udp_src_mac_lower, src_mac & 0xffffffff);
+  batch.write(*m_regs.udp_src_mac_upper, (src_mac >> 32) & 0xffff);
 
   // Load the source ip address
-  udp_ctrl.getNode("src_addr_ctrl.src_ip_addr").write(src_ip);
+  batch.write(*m_regs.udp_src_ip, src_ip);
 
   // Load the dst mac address
-  udp_ctrl.getNode("ctrl.dst_mac_addr_lower").write(dst_mac & 0xffffffff);
-  udp_ctrl.getNode("ctrl.dst_mac_addr_upper").write((dst_mac >> 32) & 0xffff);
+  batch.write(*m_regs.udp_dst_mac_lower, dst_mac & 0xffffffff);
+  batch.write(*m_regs.udp_dst_mac_upper, (dst_mac >> 32) & 0xffff);
 
   // Load the dst ip address
-  udp_ctrl.getNode("ctrl.dst_ip_addr").write(dst_ip);
+  batch.write(*m_regs.udp_dst_ip, dst_ip);
 
   // Ports
-  udp_ctrl.getNode("src_addr_ctrl.src_port").write(src_port);
-  udp_ctrl.getNode("ctrl.dst_port").write(dst_port);
+  batch.write(*m_regs.udp_src_port, src_port);
+  batch.write(*m_regs.udp_dst_port, dst_port);
 
 
-  udp_ctrl.getNode("ctrl.filter_control").write(filters);
-  udp_ctrl.getClient().dispatch();
+  batch.write(*m_regs.udp_filter_control, filters);
 
 }
 
@@ -259,31 +780,243 @@ HermesCoreController::config_udp( uint16_t link, uint64_t src_mac, uint32_t src_
 void
 HermesCoreController::config_fake_src(uint16_t link, uint16_t n_src, uint16_t data_len, uint16_t rate) {
 
-  this->sel_tx_mux(link);
+  // The buffer enable state has to be known before the batch is built
+  Batch batch(*this);
+  batch.sel_tx_mux(link);
+  auto was_en_buf = batch.read(*m_regs.tx_mux_en_buf);
+  batch.dispatch();
 
-  auto was_en_buf = m_readout.getNode("tx_path.tx_mux.csr.ctrl.en_buf").read();
-  m_readout.getNode("tx_path.tx_mux.csr.ctrl.en_buf").write(0x0);
-  m_readout.getClient().dispatch();
+  this->config_fake_src(batch, link, n_src, data_len, rate, was_en_buf.value());
+  batch.dispatch();
+}
 
 
-  for ( size_t src_id(0); src_id<m_core_info.srcs_per_mux; ++src_id) {
-    this->sel_tx_mux_buf(src_id);
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::config_fake_src(Batch& batch, uint16_t link, uint16_t n_src, uint16_t data_len, uint16_t rate, bool en_buf) {
+
+  batch.sel_tx_mux(link);
 
+  batch.write(*m_regs.tx_mux_en_buf, 0x0);
+
+  for ( size_t src_id(0); src_id<m_core_info.srcs_per_mux; ++src_id) {
+    batch.sel_tx_mux_buf(src_id);
 
     bool src_en = (src_id<n_src);
-    m_readout.getNode("tx_path.tx_mux.buf.ctrl.fake_en").write(src_en);
-    m_readout.getClient().dispatch();
+    batch.write(*m_regs.buf_fake_en, src_en);
     if (!src_en) {
       continue;
     }
-    m_readout.getNode("tx_path.tx_mux.buf.ctrl.dlen").write(data_len);
-        
-    m_readout.getNode("tx_path.tx_mux.buf.ctrl.rate_rdx").write(rate);
-    m_readout.getClient().dispatch();
+    batch.write(*m_regs.buf_dlen, data_len);
+
+    batch.write(*m_regs.buf_rate_rdx, rate);
+  }
+
+  batch.write(*m_regs.tx_mux_en_buf, en_buf);
+}
+
+
+//-----------------------------------------------------------------------------
+std::vector<HermesCoreController::LinkConfig>
+HermesCoreController::read_link_configs() {
+
+  struct LinkConfigWords {
+    uhal::ValWord<uint32_t> use_external;
+    uhal::ValWord<uint32_t> src_mac_lower;
+    uhal::ValWord<uint32_t> src_mac_upper;
+    uhal::ValWord<uint32_t> src_ip;
+    uhal::ValWord<uint32_t> src_port;
+    uhal::ValWord<uint32_t> dst_mac_lower;
+    uhal::ValWord<uint32_t> dst_mac_upper;
+    uhal::ValWord<uint32_t> dst_ip;
+    uhal::ValWord<uint32_t> dst_port;
+    uhal::ValWord<uint32_t> filters;
+    uhal::ValWord<uint32_t> det;
+    uhal::ValWord<uint32_t> crate;
+    uhal::ValWord<uint32_t> slot;
+  };
+
+  Batch batch(*this);
+
+  std::vector<LinkConfigWords> links_words(m_core_info.n_mgt);
+  for ( uint16_t i(0); i<m_core_info.n_mgt; ++i) {
+    batch.sel_tx_mux(i);
+    batch.sel_udp_core(i);
+
+    auto& words = links_words[i];
+    words.use_external = batch.read(*m_regs.udp_use_external);
+    words.src_mac_lower = batch.read(*m_regs.udp_src_mac_lower);
+    words.src_mac_upper = batch.read(*m_regs.udp_src_mac_upper);
+    words.src_ip = batch.read(*m_regs.udp_src_ip);
+    words.src_port = batch.read(*m_regs.udp_src_port);
+    words.dst_mac_lower = batch.read(*m_regs.udp_dst_mac_lower);
+    words.dst_mac_upper = batch.read(*m_regs.udp_dst_mac_upper);
+    words.dst_ip = batch.read(*m_regs.udp_dst_ip);
+    words.dst_port = batch.read(*m_regs.udp_dst_port);
+    words.filters = batch.read(*m_regs.udp_filter_control);
+    words.det = batch.read(*m_regs.mux_detid);
+    words.crate = batch.read(*m_regs.mux_crate);
+    words.slot = batch.read(*m_regs.mux_slot);
+  }
+  batch.dispatch();
+
+  std::vector<LinkConfig> configs;
+  configs.reserve(links_words.size());
+  for ( uint16_t i(0); i<links_words.size(); ++i) {
+    const auto& words = links_words[i];
+    LinkConfig cfg;
+    cfg.link = i;
+    cfg.src_mac = (uint64_t(words.src_mac_upper.value()) << 32) | words.src_mac_lower.value();
+    cfg.src_ip = words.src_ip.value();
+    cfg.src_port = words.src_port.value();
+    cfg.dst_mac = (uint64_t(words.dst_mac_upper.value()) << 32) | words.dst_mac_lower.value();
+    cfg.dst_ip = words.dst_ip.value();
+    cfg.dst_port = words.dst_port.value();
+    cfg.filters = words.filters.value();
+    cfg.det = words.det.value();
+    cfg.crate = words.crate.value();
+    cfg.slot = words.slot.value();
+    cfg.use_external = words.use_external.value();
+    configs.push_back(cfg);
+  }
+
+  return configs;
+}
+
+
+//-----------------------------------------------------------------------------
+std::vector<uint16_t>
+HermesCoreController::read_links_in_error() {
+
+  Batch batch(*this);
+
+  std::vector<uhal::ValWord<uint32_t>> errs;
+  errs.reserve(m_core_info.n_mgt);
+  for ( uint16_t i(0); i<m_core_info.n_mgt; ++i) {
+    batch.sel_tx_mux(i);
+    errs.push_back(batch.read(*m_regs.tx_mux_err));
+  }
+  batch.dispatch();
+
+  std::vector<uint16_t> links;
+  for ( uint16_t i(0); i<errs.size(); ++i) {
+    if ( errs[i].value() ) {
+      links.push_back(i);
+    }
+  }
+  return links;
+}
+
+
+//-----------------------------------------------------------------------------
+HermesCoreController::LinkConfigDiff
+HermesCoreController::diff_link_config(const LinkConfig& current, const LinkConfig& desired) const {
+
+  LinkConfigDiff diff;
+  auto update = [](auto& writes, const uhal::Node* node, uint32_t curr_value, uint32_t value) {
+    if ( curr_value != value ) {
+      writes.emplace_back(node, value);
+    }
+  };
+
+  // Same register values as config_udp
+  update(diff.udp_core, m_regs.udp_use_external, current.use_external, desired.use_external);
+  update(diff.udp_core, m_regs.udp_src_mac_lower, current.src_mac & 0xffffffff, desired.src_mac & 0xffffffff);
+  update(diff.udp_core, m_regs.udp_src_mac_upper, current.src_mac >> 32, (desired.src_mac >> 32) & 0xffff);
+  update(diff.udp_core, m_regs.udp_src_ip, current.src_ip, desired.src_ip);
+  update(diff.udp_core, m_regs.udp_src_port, current.src_port, desired.src_port);
+  update(diff.udp_core, m_regs.udp_dst_mac_lower, current.dst_mac & 0xffffffff, desired.dst_mac & 0xffffffff);
+  update(diff.udp_core, m_regs.udp_dst_mac_upper, current.dst_mac >> 32, (desired.dst_mac >> 32) & 0xffff);
+  update(diff.udp_core, m_regs.udp_dst_ip, current.dst_ip, desired.dst_ip);
+  update(diff.udp_core, m_regs.udp_dst_port, current.dst_port, desired.dst_port);
+  update(diff.udp_core, m_regs.udp_filter_control, current.filters, desired.filters);
+
+  update(diff.tx_mux, m_regs.mux_detid, current.det, desired.det);
+  update(diff.tx_mux, m_regs.mux_crate, current.crate, desired.crate);
+  update(diff.tx_mux, m_regs.mux_slot, current.slot, desired.slot);
+
+  return diff;
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::queue_link_config_diff(Batch& batch, uint16_t link, const LinkConfigDiff& diff) {
+
+  if ( !diff.udp_core.empty() ) {
+    batch.sel_udp_core(link);
+    for ( const auto& [node, value] : diff.udp_core ) {
+      batch.write(*node, value);
+    }
+  }
+
+  if ( !diff.tx_mux.empty() ) {
+    batch.sel_tx_mux(link);
+    for ( const auto& [node, value] : diff.tx_mux ) {
+      batch.write(*node, value);
+    }
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+bool
+HermesCoreController::apply_link_configs(const std::vector<LinkConfig>& desired, bool force) {
+
+  for ( const auto& cfg : desired ) {
+    if ( cfg.link >= m_core_info.n_mgt ) {
+      throw LinkDoesNotExist(ERS_HERE, cfg.link);
+    }
   }
 
-  m_readout.getNode("tx_path.tx_mux.csr.ctrl.en_buf").write(was_en_buf.value());
-  m_readout.getClient().dispatch();
+  if ( !force ) {
+    auto current = this->read_link_configs();
+
+    std::vector<LinkConfigDiff> diffs;
+    for ( const auto& cfg : desired ) {
+      diffs.push_back(this->diff_link_config(current.at(cfg.link), cfg));
+    }
+
+    bool data_path_changed = std::any_of(diffs.begin(), diffs.end(), [](const LinkConfigDiff& diff) {
+      return !diff.udp_core.empty();
+    });
+
+    if ( !data_path_changed ) {
+      // The mux geo info is only stamped in the headers of the frames,
+      // it is written in place without a reset
+      bool geo_changed = false;
+      Batch batch(*this);
+      for ( size_t i(0); i<desired.size(); ++i ) {
+        if ( !diffs[i].tx_mux.empty() ) {
+          this->queue_link_config_diff(batch, desired[i].link, diffs[i]);
+          geo_changed = true;
+        }
+      }
+      if ( geo_changed ) {
+        batch.dispatch();
+      }
+      return false;
+    }
+  }
+
+  // Only the PCS/PMA of the links configured is waited for, none if desired
+  // is empty: their ethernet needs a peer and is checked when they are started
+  std::vector<uint16_t> links;
+  for ( const auto& cfg : desired ) {
+    links.push_back(cfg.link);
+  }
+  this->reset(false, links);
+
+  // The reset may have cleared part of the configuration, compare after it
+  auto current = this->read_link_configs();
+
+  Batch batch(*this);
+  for ( const auto& cfg : desired ) {
+    this->queue_link_config_diff(batch, cfg.link, this->diff_link_config(current.at(cfg.link), cfg));
+  }
+  batch.dispatch();
+
+  return true;
 }
 
 
@@ -291,64 +1024,270 @@ HermesCoreController::config_fake_src(uint16_t link, uint16_t n_src, uint16_t da
 HermesCoreController::LinkGeoInfo
 HermesCoreController::read_link_geo_info(uint16_t link) {
 
-  this->sel_tx_mux(link);
+  Batch batch(*this);
+  batch.sel_tx_mux(link);
 
-  auto detid = m_readout.getNode("tx_path.tx_mux.mux.ctrl.detid").read();
-  auto crate = m_readout.getNode("tx_path.tx_mux.mux.ctrl.crate").read();
-  auto slot = m_readout.getNode("tx_path.tx_mux.mux.ctrl.slot").read();
+  auto detid = batch.read(*m_regs.mux_detid);
+  auto crate = batch.read(*m_regs.mux_crate);
+  auto slot = batch.read(*m_regs.mux_slot);
 
-  m_readout.getClient().dispatch();
+  batch.dispatch();
 
   return {detid.value(), crate.value(), slot.value()};
 }
 
 //-----------------------------------------------------------------------------
-  opmon::LinkInfo
-  HermesCoreController::read_link_stats(uint16_t link) {
-    this->sel_tx_mux(link);
-    this->sel_udp_core(link);
+HermesCoreController::LinkStatsWords
+HermesCoreController::queue_link_stats(Batch& batch) {
+
+  LinkStatsWords words;
+
+  words.err = batch.read(*m_regs.tx_mux_err);
+  words.eth_rdy = batch.read(*m_regs.tx_mux_eth_rdy);
+  words.src_rdy = batch.read(*m_regs.tx_mux_src_rdy);
+  words.udp_rdy = batch.read(*m_regs.tx_mux_udp_rdy);
+
+  words.rx_arp_count = batch.read(*m_regs.rx_arp_count);
+  words.rx_ping_count = batch.read(*m_regs.rx_ping_count);
+  words.rx_udp_count = batch.read(*m_regs.rx_udp_count);
+
+  words.tx_arp_count = batch.read(*m_regs.tx_arp_count);
+  words.tx_ping_count = batch.read(*m_regs.tx_ping_count);
+  words.tx_udp_count = batch.read(*m_regs.tx_udp_count);
+
+  return words;
+}
+
+
+//-----------------------------------------------------------------------------
+opmon::LinkInfo
+HermesCoreController::decode_link_stats(const LinkStatsWords& words) const {
+
+  opmon::LinkInfo info;
+
+  info.set_err(words.err.value());
+  info.set_eth_rdy(words.eth_rdy.value());
+  info.set_src_rdy(words.src_rdy.value());
+  info.set_udp_rdy(words.udp_rdy.value());
+
+  info.set_rcvd_arp_count(words.rx_arp_count.value());
+  info.set_rcvd_ping_count(words.rx_ping_count.value());
+  info.set_rcvd_udp_count(words.rx_udp_count.value());
+
+  info.set_sent_arp_count(words.tx_arp_count.value());
+  info.set_sent_ping_count(words.tx_ping_count.value());
+  info.set_sent_udp_count(words.tx_udp_count.value());
+
+  return info;
+}
+
+
+//-----------------------------------------------------------------------------
+opmon::LinkInfo
+HermesCoreController::read_link_stats(uint16_t link) {
+
+  Batch batch(*this);
+  batch.sel_tx_mux(link);
+  batch.sel_udp_core(link);
+
+  auto words = this->queue_link_stats(batch);
+  batch.dispatch();
+
+  auto info = this->decode_link_stats(words);
+  this->extend_link_counters(link, info);
+  info.set_time_to_ready_us(m_link_time_to_ready.at(link).count());
+
+  return info;
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::extend_link_counters(uint16_t link, opmon::LinkInfo& info) {
+
+  auto& c = m_link_counters.at(link);
+
+  auto now = std::chrono::steady_clock::now();
+  double max_increment = k_max_packet_rate * std::chrono::duration<double>(now - c.last_update).count();
+  c.last_update = now;
+
+  info.set_rcvd_arp_count(c.rcvd_arp.update(info.rcvd_arp_count(), max_increment));
+  info.set_rcvd_ping_count(c.rcvd_ping.update(info.rcvd_ping_count(), max_increment));
+  info.set_rcvd_udp_count(c.rcvd_udp.update(info.rcvd_udp_count(), max_increment));
+
+  info.set_sent_arp_count(c.sent_arp.update(info.sent_arp_count(), max_increment));
+  info.set_sent_ping_count(c.sent_ping.update(info.sent_ping_count(), max_increment));
+  info.set_sent_udp_count(c.sent_udp.update(info.sent_udp_count(), max_increment));
+}
+
+
+//-----------------------------------------------------------------------------
+std::vector<uhal::ValVector<uint32_t>>
+HermesCoreController::queue_buffer_stats(Batch& batch) {
+
+  std::vector<uhal::ValVector<uint32_t>> blocks;
+  blocks.reserve(m_core_info.srcs_per_mux);
+  for ( uint16_t src_id(0); src_id<m_core_info.srcs_per_mux; ++src_id) {
+    batch.sel_tx_mux_buf(src_id);
+    blocks.push_back(batch.read_block(*m_regs.buf_stat, m_regs.buf_block_size));
+  }
 
-    opmon::LinkInfo info;
+  return blocks;
+}
 
-    const auto& mux_stats = m_readout.getNode("tx_path.tx_mux.csr.stat");
-    auto err = mux_stats.getNode("err").read();
-    auto eth_rdy = mux_stats.getNode("eth_rdy").read();
-    auto src_rdy = mux_stats.getNode("src_rdy").read();
-    auto udp_rdy = mux_stats.getNode("udp_rdy").read();
-    mux_stats.getClient().dispatch();
 
-    const auto& udp_ctrl = m_readout.getNode(fmt::format("tx_path.udp_core.udp_core_control"));
-    const auto& rx_stats = udp_ctrl.getNode("rx_packet_counters");
+//-----------------------------------------------------------------------------
+opmon::BufferInfo
+HermesCoreController::decode_buffer_stats(const uhal::ValVector<uint32_t>& block) const {
 
-    auto rx_arp_count = rx_stats.getNode("arp_count").read();
-    auto rx_ping_count = rx_stats.getNode("ping_count").read();
-    auto rx_udp_count = rx_stats.getNode("udp_count").read();
-    rx_stats.getClient().dispatch();
+  const auto& base = *m_regs.buf_stat;
+  auto counter = [&](const Counter64& c) -> uint64_t {
+    return (uint64_t(block_field(block, base, *c.hi)) << 32) | block_field(block, base, *c.lo);
+  };
 
-    const auto& tx_stats = udp_ctrl.getNode("tx_packet_counters");
+  opmon::BufferInfo info;
 
-    auto tx_arp_count = tx_stats.getNode("arp_count").read();
-    auto tx_ping_count = tx_stats.getNode("ping_count").read();
-    auto tx_udp_count = tx_stats.getNode("udp_count").read();
-    tx_stats.getClient().dispatch();
+  info.set_rx_stat(block_field(block, base, *m_regs.buf_rx_stat));
+  info.set_tx_stat(block_field(block, base, *m_regs.buf_tx_stat));
 
+  info.set_lwm(block_field(block, base, *m_regs.buf_lwm));
+  info.set_hwm(block_field(block, base, *m_regs.buf_hwm));
+  info.set_llwm(block_field(block, base, *m_regs.buf_llwm));
+  info.set_lhwm(block_field(block, base, *m_regs.buf_lhwm));
 
-    info.set_err(err.value());
-    info.set_eth_rdy(eth_rdy.value());
-    info.set_src_rdy(src_rdy.value());
-    info.set_udp_rdy(udp_rdy.value());
+  info.set_ts(counter(m_regs.buf_ts));
+  info.set_vol(counter(m_regs.buf_vol));
+  info.set_blk_acc(counter(m_regs.buf_blk_acc));
+  info.set_blk_rej(counter(m_regs.buf_blk_rej));
+  info.set_blk_oflow(counter(m_regs.buf_blk_oflow));
+  info.set_blk_longlast(counter(m_regs.buf_blk_longlast));
+  info.set_blk_lastnotval(counter(m_regs.buf_blk_lastnotval));
 
-    info.set_rcvd_arp_count(rx_arp_count.value());
-    info.set_rcvd_ping_count(rx_ping_count.value());
-    info.set_rcvd_udp_count(rx_udp_count.value());
+  return info;
+}
 
-    info.set_sent_arp_count(tx_arp_count.value());
-    info.set_sent_ping_count(tx_ping_count.value());
-    info.set_sent_udp_count(tx_udp_count.value());
 
-    return info;
+//-----------------------------------------------------------------------------
+std::vector<opmon::BufferInfo>
+HermesCoreController::read_buffer_stats(uint16_t link) {
+
+  Batch batch(*this);
+  batch.sel_tx_mux(link);
 
+  auto blocks = this->queue_buffer_stats(batch);
+  batch.dispatch();
+
+  std::vector<opmon::BufferInfo> infos;
+  infos.reserve(blocks.size());
+  for ( const auto& block : blocks ) {
+    infos.push_back(this->decode_buffer_stats(block));
+  }
+
+  return infos;
+}
+
+
+//-----------------------------------------------------------------------------
+std::vector<HermesCoreController::LinkSnapshot>
+HermesCoreController::snapshot_all_links() {
+
+  struct LinkWords {
+    uhal::ValWord<uint32_t> detid;
+    uhal::ValWord<uint32_t> crate;
+    uhal::ValWord<uint32_t> slot;
+    LinkStatsWords stats;
+    std::vector<uhal::ValVector<uint32_t>> buffers;
+  };
+
+  Batch batch(*this);
+
+  // Latch all counters at the same time, so that links can be compared
+  uhal::ValWord<uint32_t> samp_ts_l, samp_ts_h;
+  if (m_regs.samp) {
+    batch.write(*m_regs.samp, 0x1);
+    batch.write(*m_regs.samp, 0x0);
+    samp_ts_l = batch.read(*m_regs.samp_ts.lo);
+    samp_ts_h = batch.read(*m_regs.samp_ts.hi);
   }
 
+  // IPbus transactions are executed in order: selector writes and reads
+  // for all links can be queued in the same packet
+  std::vector<LinkWords> links_words;
+  links_words.reserve(m_core_info.n_mgt);
+  for ( uint16_t i(0); i<m_core_info.n_mgt; ++i) {
+    batch.sel_tx_mux(i);
+    batch.sel_udp_core(i);
+
+    LinkWords words;
+    words.detid = batch.read(*m_regs.mux_detid);
+    words.crate = batch.read(*m_regs.mux_crate);
+    words.slot = batch.read(*m_regs.mux_slot);
+    words.stats = this->queue_link_stats(batch);
+    words.buffers = this->queue_buffer_stats(batch);
+    links_words.push_back(words);
+  }
+  batch.dispatch();
+
+  std::vector<LinkSnapshot> snapshots;
+  snapshots.reserve(links_words.size());
+  for ( uint16_t i(0); i<links_words.size(); ++i) {
+    const auto& words = links_words[i];
+    LinkGeoInfo geo = {
+      static_cast<uint16_t>(words.detid.value()),
+      static_cast<uint16_t>(words.crate.value()),
+      static_cast<uint16_t>(words.slot.value())
+    };
+    std::vector<opmon::BufferInfo> buffers;
+    buffers.reserve(words.buffers.size());
+    for ( const auto& block : words.buffers ) {
+      buffers.push_back(this->decode_buffer_stats(block));
+    }
+    auto stats = this->decode_link_stats(words.stats);
+    this->extend_link_counters(i, stats);
+    stats.set_time_to_ready_us(m_link_time_to_ready.at(i).count());
+    snapshots.push_back({i, geo, std::move(stats), std::move(buffers)});
+  }
+
+  if (m_regs.samp) {
+    this->update_rates((uint64_t(samp_ts_h.value()) << 32) | samp_ts_l.value(), snapshots);
+  }
+
+  return snapshots;
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreController::update_rates(uint64_t sample_ts, std::vector<LinkSnapshot>& snapshots) {
+
+  if ( m_last_sample && sample_ts > m_last_sample->ts && m_last_sample->links.size() == snapshots.size() ) {
+
+    double dt = (sample_ts - m_last_sample->ts) / k_timestamp_clock_hz;
+
+    // 64-bit counters do not wrap, going backwards means they were cleared
+    auto rate = [dt](uint64_t curr, uint64_t prev) { return (curr >= prev ? (curr - prev) / dt : 0.); };
+
+    for ( size_t i(0); i<snapshots.size(); ++i ) {
+      auto& curr = snapshots[i];
+      const auto& prev = m_last_sample->links[i];
+
+      curr.stats.set_sent_udp_rate(rate(curr.stats.sent_udp_count(), prev.stats.sent_udp_count()));
+      curr.stats.set_rcvd_udp_rate(rate(curr.stats.rcvd_udp_count(), prev.stats.rcvd_udp_count()));
+
+      for ( size_t j(0); j<curr.buffers.size() && j<prev.buffers.size(); ++j ) {
+        auto& curr_buf = curr.buffers[j];
+        const auto& prev_buf = prev.buffers[j];
+
+        curr_buf.set_vol_rate(rate(curr_buf.vol(), prev_buf.vol()));
+        curr_buf.set_blk_acc_rate(rate(curr_buf.blk_acc(), prev_buf.blk_acc()));
+        curr_buf.set_blk_rej_rate(rate(curr_buf.blk_rej(), prev_buf.blk_rej()));
+        curr_buf.set_blk_oflow_rate(rate(curr_buf.blk_oflow(), prev_buf.blk_oflow()));
+      }
+    }
+  }
+
+  m_last_sample = CounterSample{sample_ts, snapshots};
+}
+
 }
 }
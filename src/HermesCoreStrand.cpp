@@ -0,0 +1,130 @@
+#include "hermesmodules/HermesCoreStrand.hpp"
+
+namespace dunedaq {
+namespace hermesmodules {
+
+//-----------------------------------------------------------------------------
+HermesCoreStrand::HermesCoreStrand(HermesCoreController& ctrl) :
+  m_ctrl(ctrl) {
+
+  m_worker = std::thread(&HermesCoreStrand::worker, this);
+}
+
+
+//-----------------------------------------------------------------------------
+HermesCoreStrand::~HermesCoreStrand() {
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+
+  m_worker.join();
+}
+
+
+//-----------------------------------------------------------------------------
+std::future<void>
+HermesCoreStrand::submit(Priority prio, std::function<void(HermesCoreController::Batch&)> queue_fn) {
+
+  Task t;
+  t.queue_fn = std::move(queue_fn);
+  t.done = std::make_shared<std::promise<void>>();
+  auto result = t.done->get_future();
+
+  this->enqueue(prio, std::move(t));
+
+  return result;
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreStrand::enqueue(Priority prio, Task task) {
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& queue = (prio == Priority::kCommand ? m_command_queue : m_monitoring_queue);
+    queue.push_back(std::move(task));
+  }
+  m_cv.notify_one();
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreStrand::worker() {
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while (true) {
+    m_cv.wait(lock, [this] { return m_stop || !m_command_queue.empty() || !m_monitoring_queue.empty(); });
+
+    // Pending tasks are completed before stopping
+    if ( m_command_queue.empty() && m_monitoring_queue.empty() ) {
+      return;
+    }
+
+    auto& queue = (!m_command_queue.empty() ? m_command_queue : m_monitoring_queue);
+
+    if ( queue.front().exclusive_fn ) {
+      Task task = std::move(queue.front());
+      queue.pop_front();
+
+      lock.unlock();
+      // Exceptions are forwarded to the future by the packaged task
+      task.exclusive_fn(m_ctrl);
+      lock.lock();
+    } else {
+      this->run_batch(lock, queue);
+    }
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+void
+HermesCoreStrand::run_batch(std::unique_lock<std::mutex>& lock, std::deque<Task>& queue) {
+
+  // Collect the adjacent batch tasks while the queue lock is held
+  std::deque<Task> tasks;
+  while ( !queue.empty() && queue.front().queue_fn ) {
+    tasks.push_back(std::move(queue.front()));
+    queue.pop_front();
+  }
+
+  lock.unlock();
+
+  // Each task is staged, so that the transactions of a task throwing while
+  // queuing are not sent along with the others
+  HermesCoreController::Batch batch(m_ctrl);
+  std::deque<Task> queued;
+  for ( auto& task : tasks ) {
+    try {
+      batch.stage();
+      task.queue_fn(batch);
+      batch.commit_staged();
+      queued.push_back(std::move(task));
+    } catch ( ... ) {
+      batch.drop_staged();
+      task.done->set_exception(std::current_exception());
+    }
+  }
+
+  try {
+    batch.dispatch();
+    for ( auto& task : queued ) {
+      task.done->set_value();
+    }
+  } catch ( ... ) {
+    for ( auto& task : queued ) {
+      task.done->set_exception(std::current_exception());
+    }
+  }
+
+  lock.lock();
+}
+
+}
+}
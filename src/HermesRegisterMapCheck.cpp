@@ -0,0 +1,59 @@
+// Compile-time checks of the generated register map against the registers
+// used by HermesCoreController: a table lacking one of them, or with a
+// different layout, breaks the build instead of failing in load_hw_info.
+
+#include "hermesmodules/HermesRegisterMap.hpp"
+
+namespace dunedaq {
+namespace hermesmodules {
+namespace regmap {
+
+static_assert(Register<info::magic>::is_full_word, "info.magic must be a full register");
+static_assert(Register<csr::ctrl::nuke>::mask == 0x1 && Register<csr::ctrl::soft_rst>::mask == 0x2,
+              "Unexpected layout of the core reset bits");
+
+// wait_links_ready decodes the tx_mux status bits from a single read of the stat register
+namespace tx_mux_stat = tx_path::tx_mux::csr::stat;
+static_assert(tx_mux_stat::err.address == tx_mux_stat::node.address &&
+              tx_mux_stat::eth_rdy.address == tx_mux_stat::node.address &&
+              tx_mux_stat::src_rdy.address == tx_mux_stat::node.address &&
+              tx_mux_stat::udp_rdy.address == tx_mux_stat::node.address,
+              "The tx_mux status bits must share the stat register");
+
+// The selectors are written as a whole, the link index must fit in them
+static_assert(Register<tx_path::csr_tx_mux::ctrl::tx_mux_sel>::shift == 0, "Unexpected tx_mux_sel layout");
+static_assert(Register<tx_path::csr_udp_core::ctrl::udp_core_sel>::shift == 0, "Unexpected udp_core_sel layout");
+
+// Link configuration registers read back by read_link_configs
+namespace udp_ctrl = tx_path::udp_core::udp_core_control;
+static_assert(Register<udp_ctrl::src_addr_ctrl::src_mac_addr_lower>::is_full_word, "Unexpected src_mac_addr_lower layout");
+static_assert(Register<udp_ctrl::ctrl::dst_mac_addr_lower>::is_full_word, "Unexpected dst_mac_addr_lower layout");
+static_assert(Register<udp_ctrl::ctrl::dst_ip_addr>::is_full_word, "Unexpected dst_ip_addr layout");
+static_assert(Register<tx_path::tx_mux::mux::ctrl::detid>::mask != 0 &&
+              Register<tx_path::tx_mux::mux::ctrl::crate>::mask != 0 &&
+              Register<tx_path::tx_mux::mux::ctrl::slot>::mask != 0,
+              "Missing mux geo fields");
+
+// The Zynq bridge reads the firmware identification as whole registers and
+// unpacks the fields from them
+static_assert(info::versions::design.address == info::versions::node.address &&
+              info::versions::patch.address == info::versions::node.address,
+              "The version fields must share the versions register");
+static_assert(info::generics::n_mgts.address == info::generics::node.address &&
+              info::generics::n_srcs.address == info::generics::node.address,
+              "The generics fields must share the generics register");
+
+// The publisher of the Zynq bridge pulses samp with two RMWBits
+// transactions, each replied with a data word, and takes the sample time
+// from the raw words of samp_ts
+static_assert(!Register<samp::ctrl::samp>::is_full_word, "samp must be a partial field, written with RMWBits");
+static_assert(Register<samp::samp_ts_l>::is_full_word && Register<samp::samp_ts_h>::is_full_word,
+              "Unexpected samp_ts layout");
+
+// Block reads of the input buffer statistics start at buf.stat
+static_assert(tx_path::tx_mux::buf::stat::node.address < tx_path::tx_mux::buf::buf_mon::node.address,
+              "Unexpected layout of the input buffer statistics block");
+
+} // namespace regmap
+} // namespace hermesmodules
+} // namespace dunedaq
@@ -0,0 +1,181 @@
+/**
+ * @file BoardTaskPool_test.cxx
+ *
+ * Unit tests of the per-board task pool behind HermesBoardGroup
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#define BOOST_TEST_MODULE BoardTaskPool_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include "hermesmodules/BoardTaskPool.hpp"
+
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+using dunedaq::hermesmodules::BoardTaskPool;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Holds the tasks of a board until released. Declared after the pool, so
+// that a failed check does not leave the pool threads waiting on it.
+struct Gate {
+  std::promise<void> promise;
+  std::shared_future<void> future = promise.get_future().share();
+  bool released = false;
+
+  ~Gate() { release(); }
+
+  void release() {
+    if ( !released ) {
+      promise.set_value();
+      released = true;
+    }
+  }
+};
+
+// Run no-op tasks until the board is no longer busy with a task given up on
+BoardTaskPool::BoardResult
+wait_idle(BoardTaskPool& pool, const std::string& board) {
+  BoardTaskPool::BoardResult res;
+  for ( int i(0); i<100; ++i ) {
+    for ( auto& r : pool.for_each([](const std::string&) {}, 1000ms) ) {
+      if ( r.board == board ) {
+        res = r;
+      }
+    }
+    if ( res.ok ) {
+      break;
+    }
+    std::this_thread::sleep_for(10ms);
+  }
+  return res;
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(BoardTaskPool_test)
+
+BOOST_AUTO_TEST_CASE(AllBoardsSucceed)
+{
+  BoardTaskPool pool(2);
+  pool.add_board("c");
+  pool.add_board("a");
+  pool.add_board("b");
+
+  std::atomic<int> n_calls{0};
+  auto results = pool.for_each([&n_calls](const std::string&) {
+    std::this_thread::sleep_for(10ms);
+    ++n_calls;
+  }, 1000ms);
+
+  BOOST_REQUIRE_EQUAL(n_calls, 3);
+  BOOST_REQUIRE_EQUAL(results.size(), 3u);
+  BOOST_REQUIRE_EQUAL(results[0].board, "a");
+  BOOST_REQUIRE_EQUAL(results[1].board, "b");
+  BOOST_REQUIRE_EQUAL(results[2].board, "c");
+  for ( const auto& r : results ) {
+    BOOST_REQUIRE(r.ok);
+    BOOST_REQUIRE(!r.timed_out);
+    BOOST_REQUIRE(r.error.empty());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(DuplicateBoard)
+{
+  BoardTaskPool pool(1);
+  pool.add_board("a");
+  BOOST_REQUIRE_THROW(pool.add_board("a"), dunedaq::hermesmodules::BoardAlreadyInGroup);
+  BOOST_REQUIRE(pool.has_board("a"));
+  BOOST_REQUIRE(!pool.has_board("b"));
+}
+
+BOOST_AUTO_TEST_CASE(ErrorIsReported)
+{
+  BoardTaskPool pool(2);
+  pool.add_board("a");
+  pool.add_board("b");
+
+  auto results = pool.for_each([](const std::string& board) {
+    if ( board == "b" ) {
+      throw std::runtime_error("link 3 not ready");
+    }
+  }, 1000ms);
+
+  BOOST_REQUIRE(results[0].ok);
+  BOOST_REQUIRE(!results[1].ok);
+  BOOST_REQUIRE(!results[1].timed_out);
+  BOOST_REQUIRE_EQUAL(results[1].error, "link 3 not ready");
+}
+
+BOOST_AUTO_TEST_CASE(TimedOutBoardIsBusy)
+{
+  BoardTaskPool pool(2);
+  Gate gate;
+  pool.add_board("fast");
+  pool.add_board("slow");
+
+  auto start = std::chrono::steady_clock::now();
+  auto results = pool.for_each([f = gate.future](const std::string& board) {
+    if ( board == "slow" ) {
+      f.wait();
+    }
+  }, 50ms);
+
+  // The slow board does not hold the others back
+  BOOST_REQUIRE(std::chrono::steady_clock::now() - start < 1000ms);
+  BOOST_REQUIRE(results[0].ok);
+  BOOST_REQUIRE(!results[1].ok);
+  BOOST_REQUIRE(results[1].timed_out);
+  BOOST_REQUIRE(results[1].duration >= 50ms);
+
+  // The task given up on still runs, the board is skipped meanwhile
+  std::atomic<int> n_calls{0};
+  results = pool.for_each([&n_calls](const std::string&) { ++n_calls; }, 1000ms);
+  BOOST_REQUIRE_EQUAL(n_calls, 1);
+  BOOST_REQUIRE(results[0].ok);
+  BOOST_REQUIRE(!results[1].ok);
+  BOOST_REQUIRE(!results[1].timed_out);
+  BOOST_REQUIRE_EQUAL(results[1].error, "busy with a task that timed out");
+
+  gate.release();
+  BOOST_REQUIRE(wait_idle(pool, "slow").ok);
+}
+
+BOOST_AUTO_TEST_CASE(NoThreadLeft)
+{
+  BoardTaskPool pool(1);
+  Gate gate;
+  pool.add_board("a");
+  pool.add_board("b");
+
+  // The only thread is stuck on the first board, the second one never starts
+  std::atomic<int> n_b_calls{0};
+  auto results = pool.for_each([f = gate.future, &n_b_calls](const std::string& board) {
+    if ( board == "a" ) {
+      f.wait();
+    } else {
+      ++n_b_calls;
+    }
+  }, 50ms);
+
+  BOOST_REQUIRE(results[0].timed_out);
+  BOOST_REQUIRE(!results[1].ok);
+  BOOST_REQUIRE(!results[1].timed_out);
+  BOOST_REQUIRE_EQUAL(results[1].error, "no thread available, all are busy with tasks that timed out");
+
+  // Once the thread is back, the job queued for the second board is dropped
+  gate.release();
+  BOOST_REQUIRE(wait_idle(pool, "a").ok);
+  BOOST_REQUIRE_EQUAL(n_b_calls, 0);
+  BOOST_REQUIRE(wait_idle(pool, "b").ok);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,98 @@
+/**
+ * @file CounterExtender_test.cxx
+ *
+ * Unit tests of the 32 to 64-bit extension of the hardware counters
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#define BOOST_TEST_MODULE CounterExtender_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include "hermesmodules/CounterExtender.hpp"
+
+#include <limits>
+
+using dunedaq::hermesmodules::CounterExtender;
+
+namespace {
+constexpr double k_no_limit = std::numeric_limits<double>::infinity();
+}
+
+BOOST_AUTO_TEST_SUITE(CounterExtender_test)
+
+BOOST_AUTO_TEST_CASE(FirstReading)
+{
+  CounterExtender c;
+  BOOST_REQUIRE_EQUAL(c.value(), 0u);
+  BOOST_REQUIRE_EQUAL(c.update(1234, k_no_limit), 1234u);
+  BOOST_REQUIRE_EQUAL(c.value(), 1234u);
+}
+
+BOOST_AUTO_TEST_CASE(NormalIncrement)
+{
+  CounterExtender c;
+  c.update(100, k_no_limit);
+  BOOST_REQUIRE_EQUAL(c.update(150, k_no_limit), 150u);
+  BOOST_REQUIRE_EQUAL(c.update(150, k_no_limit), 150u);
+  BOOST_REQUIRE_EQUAL(c.update(1000, 1000), 1000u);
+}
+
+BOOST_AUTO_TEST_CASE(Wrap)
+{
+  CounterExtender c;
+  c.update(0xfffffff0, k_no_limit);
+
+  // 0x20 counts across the 32-bit boundary
+  BOOST_REQUIRE_EQUAL(c.update(0x10, 1000), 0x100000010ull);
+
+  // Counting keeps going from the extended value
+  BOOST_REQUIRE_EQUAL(c.update(0x20, 1000), 0x100000020ull);
+}
+
+BOOST_AUTO_TEST_CASE(ClearDetectedByMaxIncrement)
+{
+  CounterExtender c;
+  c.update(1000000, k_no_limit);
+
+  // Going backwards with an implausible wrap increment: the counter was
+  // cleared and has counted 50 since
+  BOOST_REQUIRE_EQUAL(c.update(50, 1000), 1000050u);
+  BOOST_REQUIRE_EQUAL(c.update(80, 1000), 1000080u);
+}
+
+BOOST_AUTO_TEST_CASE(WrapAtMaxIncrement)
+{
+  CounterExtender c;
+  c.update(0xffffff00, k_no_limit);
+
+  // An increment of exactly max_increment is still a wrap
+  BOOST_REQUIRE_EQUAL(c.update(0x0, 0x100), 0x100000000ull);
+}
+
+BOOST_AUTO_TEST_CASE(RebaseAfterReset)
+{
+  CounterExtender c;
+  c.update(100, k_no_limit);
+
+  // A reset cleared the counter, which has counted 150 since. Without
+  // rebase the reading would be taken as an increment of 50.
+  c.rebase();
+  BOOST_REQUIRE_EQUAL(c.update(150, k_no_limit), 250u);
+  BOOST_REQUIRE_EQUAL(c.update(160, k_no_limit), 260u);
+}
+
+BOOST_AUTO_TEST_CASE(RebaseAfterResetWithWrapLimit)
+{
+  CounterExtender c;
+  c.update(0xfffffff0, k_no_limit);
+
+  // After rebase a small reading is counted from zero, not as a wrap
+  c.rebase();
+  BOOST_REQUIRE_EQUAL(c.update(0x10, 1000), 0xfffffff0ull + 0x10);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
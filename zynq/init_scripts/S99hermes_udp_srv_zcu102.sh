@@ -1,2 +1,4 @@
 echo "Starting Hermes IPBus UDP server"
-/bin/hermes_udp_srv -d zcu102 -c true 2>/var/log/hermes_udp_srv.err >/var/log/hermes_udp_srv.log &
\ No newline at end of file
+# Pinned to the last core, at a real-time priority above the board software,
+# with its memory locked, so that configure times do not depend on the other load
+/bin/hermes_udp_srv -d zcu102 -c true --cpu 3 --rt-prio 50 --mlock --prefault 2>/var/log/hermes_udp_srv.err >/var/log/hermes_udp_srv.log &
\ No newline at end of file
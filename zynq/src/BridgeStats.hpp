@@ -0,0 +1,187 @@
+#ifndef __BRIDGESTATS_HPP__
+#define __BRIDGESTATS_HPP__
+
+#include "UDPSocket.hpp"
+#include "Completion.hpp"
+#include "IPbusPacket.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+
+namespace stats {
+
+using Clock = std::chrono::steady_clock;
+
+// Latency histogram with log2 buckets: bucket i counts the samples shorter
+// than 2^i us, the last bucket everything slower
+class Histogram {
+public:
+    static constexpr size_t N_BUCKETS = 20;
+
+    void add(std::chrono::nanoseconds d) {
+        uint64_t ns = d.count() > 0 ? d.count() : 0;
+        uint64_t us = ns / 1000;
+        size_t i(0);
+        while ( i+1 < N_BUCKETS && (us >> i) != 0 ) {
+            ++i;
+        }
+        ++m_buckets[i];
+        ++m_count;
+        m_sum_ns += ns;
+        m_max_ns = std::max(m_max_ns, ns);
+    }
+
+    uint64_t count() const { return m_count; }
+    uint64_t avg_ns() const { return m_count ? m_sum_ns / m_count : 0; }
+    uint64_t max_ns() const { return m_max_ns; }
+
+    void write_json(std::ostream& os) const {
+        os << "{\"count\":" << m_count
+           << ",\"avg_us\":" << this->avg_ns() / 1000
+           << ",\"max_us\":" << m_max_ns / 1000
+           << ",\"buckets\":[";
+        for ( size_t i(0); i<N_BUCKETS; ++i ) {
+            os << (i ? "," : "") << m_buckets[i];
+        }
+        os << "]}";
+    }
+
+private:
+    std::array<uint64_t, N_BUCKETS> m_buckets{};
+    uint64_t m_count = 0;
+    uint64_t m_sum_ns = 0;
+    uint64_t m_max_ns = 0;
+};
+
+// Stages of a request through the bridge
+enum Stage {
+    kReceive,         // recvmmsg call
+    kPageWrite,       // request written to the transactor page
+    kTransactorWait,  // from the page write to the reply being published
+    kPageRead,        // reply read from the transactor page
+    kSend,            // sendmmsg call
+    N_STAGES
+};
+
+inline const char* to_string(Stage s) {
+    switch (s) {
+        case kReceive: return "receive";
+        case kPageWrite: return "page_write";
+        case kTransactorWait: return "transactor_wait";
+        case kPageRead: return "page_read";
+        case kSend: return "send";
+        case N_STAGES: break;
+    }
+    return "unknown";
+}
+
+struct BridgeStats {
+    uint64_t n_requests = 0;
+    uint64_t n_replies = 0;
+    uint64_t n_timeouts = 0;
+    std::array<Histogram, N_STAGES> stages;
+
+    void add(Stage s, std::chrono::nanoseconds d) { stages[s].add(d); }
+
+    void print(std::ostream& os) const {
+        for ( size_t i(0); i<N_STAGES; ++i ) {
+            const auto& h = stages[i];
+            os << "Stage " << to_string(Stage(i)) << ": count " << h.count()
+               << ", avg " << h.avg_ns() / 1000 << " us"
+               << ", max " << h.max_ns() / 1000 << " us" << std::endl;
+        }
+    }
+
+    void write_json(std::ostream& os) const {
+        os << "\"requests\":" << n_requests
+           << ",\"replies\":" << n_replies
+           << ",\"timeouts\":" << n_timeouts
+           << ",\"stages\":{";
+        for ( size_t i(0); i<N_STAGES; ++i ) {
+            os << (i ? "," : "") << "\"" << to_string(Stage(i)) << "\":";
+            stages[i].write_json(os);
+        }
+        os << "}";
+    }
+};
+
+inline void write_json(std::ostream& os, const completion::Stats& s) {
+    os << "{\"waits\":" << s.n_waits
+       << ",\"wakes\":" << s.n_wakes
+       << ",\"timeouts\":" << s.n_timeouts
+       << ",\"polls\":" << s.n_polls
+       << ",\"pauses\":" << s.n_pauses
+       << ",\"interrupts\":" << s.n_interrupts
+       << ",\"wait_us\":" << s.wait_ns / 1000
+       << ",\"max_wait_us\":" << s.max_wait_ns / 1000
+       << ",\"cpu_us\":" << s.cpu_ns / 1000 << "}";
+}
+
+inline void write_json(std::ostream& os, const ipbus::PacketTracker::Stats& s) {
+    os << "{\"forwarded\":" << s.n_forwarded
+       << ",\"without_id\":" << s.n_unreliable
+       << ",\"status\":" << s.n_status
+       << ",\"resends\":" << s.n_resends
+       << ",\"resends_missed\":" << s.n_resends_missed
+       << ",\"duplicates\":" << s.n_duplicates
+       << ",\"unexpected\":" << s.n_unexpected
+       << ",\"malformed\":" << s.n_malformed
+       << ",\"rewinds\":" << s.n_rewinds << "}";
+}
+
+// Answers every datagram received on its socket with the current
+// statistics as a JSON document. A request starting with "GET" gets an
+// HTTP response, e.g. `echo GET | nc -u -w1 <board> 50002`.
+class StatsServer {
+public:
+    using Writer = std::function<void(std::ostream&)>;
+
+    StatsServer(UDPSocket& sock, Writer writer) : m_sock(sock), m_writer(std::move(writer)) {}
+
+    void on_readable() {
+        char request[k_max_request];
+        UDPSocket::IPv4 peer;
+        int n;
+        while ( (n = this->receive(request, sizeof(request), peer)) >= 0 ) {
+            std::ostringstream os;
+            if ( n >= 3 && std::string(request, 3) == "GET" ) {
+                os << "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\n\r\n";
+            }
+            m_writer(os);
+            os << "\n";
+
+            std::string reply = os.str();
+            try {
+                m_sock.send_from(reply.data(), reply.size(), peer);
+            } catch (udp::SendError& e) {
+                std::cerr << "Error while sending statistics" << std::endl;
+            }
+        }
+    }
+
+private:
+
+    int receive(char* request, size_t capacity, UDPSocket::IPv4& peer) {
+        try {
+            return m_sock.recv_into(request, capacity, peer);
+        } catch (udp::RecvError& e) {
+            std::cerr << "Error while receiving a statistics request" << std::endl;
+            return -1;
+        }
+    }
+
+    static constexpr size_t k_max_request = 512;
+
+    UDPSocket& m_sock;
+    Writer m_writer;
+};
+
+}
+#endif
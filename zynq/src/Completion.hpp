@@ -0,0 +1,272 @@
+#ifndef __COMPLETION_HPP__
+#define __COMPLETION_HPP__
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+
+namespace completion {
+
+struct UioOpenError : public std::exception
+{
+    const char * what () const throw ()
+    {
+        return "Failed to open the UIO device";
+    }
+};
+
+// How the bridge waits for the transactor to complete a request
+enum class Strategy {
+    kSleep,      // sleep between two status reads
+    kPoll,       // read the status continuously
+    kSpinYield,  // read continuously for a bounded number of polls, then yield the CPU between reads
+    kUio,        // block on the UIO interrupt of the transactor
+};
+
+inline const char* to_string(Strategy s) {
+    switch (s) {
+        case Strategy::kSleep: return "sleep";
+        case Strategy::kPoll: return "poll";
+        case Strategy::kSpinYield: return "spin-yield";
+        case Strategy::kUio: return "uio";
+    }
+    return "unknown";
+}
+
+inline bool parse_strategy(const std::string& name, Strategy& s) {
+    for ( auto c : {Strategy::kSleep, Strategy::kPoll, Strategy::kSpinYield, Strategy::kUio} ) {
+        if ( name == to_string(c) ) {
+            s = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Hint to the CPU that this is a busy-wait loop
+inline void cpu_relax() {
+#if defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#elif defined(__x86_64__) || defined(__i386__)
+    asm volatile("pause" ::: "memory");
+#else
+    asm volatile("" ::: "memory");
+#endif
+}
+
+inline uint64_t thread_cpu_ns() {
+    timespec ts;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+struct Config {
+    Strategy strategy = Strategy::kSleep;
+    // Interval between status reads of the sleep strategy
+    std::chrono::microseconds sleep = std::chrono::microseconds(1000);
+    // Status reads before the spin-yield strategy starts yielding
+    uint32_t spin_polls = 1000;
+    // UIO device of the transactor interrupt, e.g. /dev/uio0
+    std::string uio_device;
+};
+
+// Latency and CPU usage of the waits
+struct Stats {
+    uint64_t n_waits = 0;
+    // Waits interrupted to handle other events
+    uint64_t n_wakes = 0;
+    uint64_t n_timeouts = 0;
+    uint64_t n_polls = 0;
+    // Sleeps, yields or interrupt waits
+    uint64_t n_pauses = 0;
+    uint64_t n_interrupts = 0;
+    uint64_t wait_ns = 0;
+    uint64_t max_wait_ns = 0;
+    uint64_t cpu_ns = 0;
+};
+
+class Waiter {
+public:
+    explicit Waiter(const Config& cfg) : m_cfg(cfg) {
+        if ( m_cfg.strategy == Strategy::kUio ) {
+            m_uio_fd = ::open(m_cfg.uio_device.c_str(), O_RDWR);
+            if ( m_uio_fd < 0 ) {
+                throw UioOpenError();
+            }
+        }
+    }
+
+    ~Waiter() {
+        if ( m_uio_fd >= 0 ) {
+            ::close(m_uio_fd);
+        }
+    }
+
+    Waiter(const Waiter&) = delete;
+    Waiter& operator=(const Waiter&) = delete;
+
+    enum class Result {
+        kCompleted,
+        kWoken,
+        kTimeout,
+    };
+
+    // Poll done() until it returns true or timeout expires.
+    // Returns false on timeout.
+    template<typename F>
+    bool wait(F&& done, std::chrono::nanoseconds timeout) {
+        return this->wait(done, []() { return false; }, timeout) == Result::kCompleted;
+    }
+
+    // Poll done() until it returns true, wake() returns true or timeout expires
+    template<typename F, typename W>
+    Result wait(F&& done, W&& wake, std::chrono::nanoseconds timeout) {
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t cpu_start = thread_cpu_ns();
+
+        // The interrupt is enabled before the first poll, a completion
+        // between the poll and the wait is not missed
+        if ( m_cfg.strategy == Strategy::kUio ) {
+            this->uio_arm();
+        }
+
+        Result result = Result::kTimeout;
+        for ( uint64_t n_polls(1); ; ++n_polls ) {
+            ++m_stats.n_polls;
+            if ( done() ) {
+                result = Result::kCompleted;
+                break;
+            }
+            // wake() may be a syscall: busy polls only check it every
+            // k_wake_polls reads, the pauses every time
+            if ( (this->pauses(n_polls) || n_polls % k_wake_polls == 0) && wake() ) {
+                result = Result::kWoken;
+                break;
+            }
+
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            if ( elapsed > timeout ) {
+                break;
+            }
+            this->pause(n_polls, timeout - elapsed);
+        }
+
+        uint64_t wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        m_stats.cpu_ns += thread_cpu_ns() - cpu_start;
+        switch (result) {
+            case Result::kCompleted:
+                ++m_stats.n_waits;
+                m_stats.wait_ns += wait_ns;
+                m_stats.max_wait_ns = std::max(m_stats.max_wait_ns, wait_ns);
+                break;
+            case Result::kWoken:
+                ++m_stats.n_wakes;
+                break;
+            case Result::kTimeout:
+                ++m_stats.n_timeouts;
+                break;
+        }
+        return result;
+    }
+
+    // The interrupt wait also returns when fd is readable, so that the
+    // caller's wake() can take it into account
+    void set_wake_fd(int fd) { m_wake_fd = fd; }
+
+    const Config& config() const { return m_cfg; }
+
+    const Stats& stats() const { return m_stats; }
+
+    void print_stats(std::ostream& os) const {
+        const auto& s = m_stats;
+        os << "Completion (" << to_string(m_cfg.strategy) << "):"
+           << " waits " << s.n_waits
+           << ", wakes " << s.n_wakes
+           << ", timeouts " << s.n_timeouts
+           << ", polls " << s.n_polls
+           << ", pauses " << s.n_pauses
+           << ", interrupts " << s.n_interrupts
+           << ", avg wait " << (s.n_waits ? s.wait_ns / s.n_waits / 1000 : 0) << " us"
+           << ", max wait " << s.max_wait_ns / 1000 << " us"
+           << ", cpu " << s.cpu_ns / 1000000 << " ms" << std::endl;
+    }
+
+private:
+
+    // The pause after the n_polls-th read sleeps, yields or blocks
+    bool pauses(uint64_t n_polls) const {
+        switch (m_cfg.strategy) {
+            case Strategy::kPoll:
+                return false;
+            case Strategy::kSpinYield:
+                return n_polls >= m_cfg.spin_polls;
+            default:
+                return true;
+        }
+    }
+
+    void pause(uint64_t n_polls, std::chrono::nanoseconds remaining) {
+        switch (m_cfg.strategy) {
+            case Strategy::kSleep:
+                ++m_stats.n_pauses;
+                std::this_thread::sleep_for(m_cfg.sleep);
+                break;
+            case Strategy::kPoll:
+                cpu_relax();
+                break;
+            case Strategy::kSpinYield:
+                if ( n_polls < m_cfg.spin_polls ) {
+                    cpu_relax();
+                } else {
+                    ++m_stats.n_pauses;
+                    ::sched_yield();
+                }
+                break;
+            case Strategy::kUio:
+                ++m_stats.n_pauses;
+                this->uio_wait(remaining);
+                break;
+        }
+    }
+
+    void uio_arm() {
+        uint32_t enable = 1;
+        if ( ::write(m_uio_fd, &enable, sizeof(enable)) != sizeof(enable) ) {
+            std::cerr << "WARNING: failed to enable the UIO interrupt" << std::endl;
+        }
+    }
+
+    void uio_wait(std::chrono::nanoseconds remaining) {
+        // Bounded, so that a lost interrupt only costs an extra poll
+        auto timeout_ms = std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count() + 1;
+        pollfd pfds[2] = { { m_uio_fd, POLLIN, 0 }, { m_wake_fd, POLLIN, 0 } };
+        int ret = ::poll(pfds, m_wake_fd < 0 ? 1 : 2, std::min<int64_t>(timeout_ms, k_uio_max_wait_ms));
+        if ( ret > 0 && (pfds[0].revents & POLLIN) ) {
+            uint32_t count;
+            if ( ::read(m_uio_fd, &count, sizeof(count)) == sizeof(count) ) {
+                ++m_stats.n_interrupts;
+            }
+            this->uio_arm();
+        }
+    }
+
+    static constexpr int64_t k_uio_max_wait_ms = 10;
+    static constexpr uint64_t k_wake_polls = 256;
+
+    Config m_cfg;
+    int m_uio_fd = -1;
+    int m_wake_fd = -1;
+    Stats m_stats;
+};
+
+}
+#endif
@@ -9,7 +9,13 @@
 #include <sys/mman.h>
 #include <set>
 #include <algorithm>
+#include <cstring>
 #include <sstream>
+#include <string>
+#include <vector>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 
 namespace devmem {
@@ -22,11 +28,88 @@ struct DevMemMappingError : public std::exception
     }
 };
 
-class DevMem {
+struct DevMemRangeError : public std::exception
+{
+	const char * what () const throw ()
+    {
+    	return "Access outside of the mapped /dev/mem range";
+    }
+};
+
+// Width of the bus accesses of the block transfers. Wider accesses need
+// an AXI interconnect that converts them for the slave: 32-bit AXI4-Lite
+// slaves behind a plain crossbar only accept single 32-bit accesses.
+enum class AccessMode {
+    k32,     // one 32-bit access per word
+    k64,     // 64-bit accesses on 8-byte aligned addresses
+    kBurst,  // 128-bit NEON accesses on 16-byte aligned addresses, 64-bit without NEON
+};
+
+inline const char* to_string(AccessMode m) {
+    switch (m) {
+        case AccessMode::k32: return "32";
+        case AccessMode::k64: return "64";
+        case AccessMode::kBurst: return "burst";
+    }
+    return "unknown";
+}
+
+inline bool parse_access_mode(const std::string& name, AccessMode& m) {
+    for ( auto c : {AccessMode::k32, AccessMode::k64, AccessMode::kBurst} ) {
+        if ( name == to_string(c) ) {
+            m = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Orders the device accesses before the barrier with those after it,
+// also against the accesses of the other bus masters
+inline void io_barrier() {
+#if defined(__aarch64__) || defined(__arm__)
+    asm volatile("dmb osh" ::: "memory");
+#else
+    __sync_synchronize();
+#endif
+}
+
+// Memory window of the ipbus transactor, addressed in 32-bit words
+class Backend {
 public:
-    DevMem(size_t base_addr, size_t addr_len) {
+    virtual ~Backend() = default;
+
+    // Length of the window, in words
+    virtual size_t size() const = 0;
+
+    virtual uint32_t read(uint32_t addr) = 0;
+    virtual void write(uint32_t addr, uint32_t val) = 0;
+
+    // Block accesses from and to caller-owned buffers
+    virtual void read_block(uint32_t addr, uint32_t* block, size_t size) = 0;
+    virtual void write_block(uint32_t addr, const uint32_t* block, size_t size) = 0;
+
+    std::vector<uint32_t> read_block(uint32_t addr, size_t size) {
+        std::vector<uint32_t> block(size);
+        read_block(addr, block.data(), size);
+        return block;
+    }
+
+    void write_block(uint32_t addr, const std::vector<uint32_t>& block) {
+        write_block(addr, block.data(), block.size());
+    }
+};
+
+// Transactor window in the physical address space, mapped from /dev/mem
+class DevMem : public Backend {
+public:
+    // With prefault, the page tables of the whole window are populated at
+    // mapping time rather than on the first access
+    DevMem(size_t base_addr, size_t addr_len, AccessMode mode = AccessMode::k32, bool prefault = false) {
 	    m_base_addr = base_addr;
         m_addr_len = addr_len;
+        m_mode = mode;
+        m_prefault = prefault;
 
         int r = mem_map();
         if ( r != 0 ) {
@@ -38,36 +121,111 @@ public:
         mem_unmap();
     }
 
-    uint32_t read(uint32_t addr) {
+    size_t size() const override { return m_addr_len; }
+
+    AccessMode access_mode() const { return m_mode; }
+
+    uint32_t read(uint32_t addr) override {
+        check_range(addr, 1);
         uint32_t val = *(m_base_ptr+addr);
         return val;
     }
 
-    void write(uint32_t addr, uint32_t val) {
+    void write(uint32_t addr, uint32_t val) override {
+        check_range(addr, 1);
         *(m_base_ptr+addr) = val;
     }
 
-    std::vector<uint32_t> read_block(uint32_t addr, size_t size) {
-        // This doesn't work
-        // std::vector<uint32_t> block(m_base_ptr+addr, m_base_ptr+addr+size);
+    using Backend::read_block;
+    using Backend::write_block;
 
-        // But a for loop does?
-        std::vector<uint32_t> block(size);
-        for( size_t i(0); i<size; ++i) {
-            block[i] = *(m_base_ptr+addr+i);
-        }
-        return block;
+    // The mapping is accessed through volatile pointers only: memcpy and
+    // plain pointers let the compiler merge, split, reorder or drop
+    // accesses, and use access widths the slave does not accept.
+    void read_block(uint32_t addr, uint32_t* block, size_t size) override {
+        check_range(addr, size);
+
+        // Reads are not started before the accesses preceding the call, e.g.
+        // the status read telling the block is ready
+        io_barrier();
 
+        volatile uint32_t* src = m_base_ptr+addr;
+        size_t i(0);
+        switch (m_mode) {
+            case AccessMode::kBurst:
+#if defined(__ARM_NEON)
+                for( ; i<size && ((uintptr_t)(src+i) & 0xf); ++i) {
+                    block[i] = src[i];
+                }
+                for( ; i+4<=size; i+=4) {
+                    vst1q_u32(block+i, vld1q_u32((const uint32_t*)(src+i)));
+                }
+                break;
+#else
+                [[fallthrough]];
+#endif
+            case AccessMode::k64:
+                if( i<size && ((uintptr_t)(src+i) & 0x7) ) {
+                    block[i] = src[i];
+                    ++i;
+                }
+                for( ; i+2<=size; i+=2) {
+                    uint64_t pair = *(volatile uint64_t*)(src+i);
+                    ::memcpy(block+i, &pair, sizeof(pair));
+                }
+                break;
+            case AccessMode::k32:
+                break;
+        }
+        for( ; i<size; ++i) {
+            block[i] = src[i];
+        }
     }
 
-    void write_block(uint32_t addr, const std::vector<uint32_t>& block) {
-        // This doesn't work
-        // ::memcpy((char*)(m_base_ptr+addr), block.data(), block.size()*sizeof(uint32_t));
-        
-        // But a for loop does?
-        for( size_t i(0); i<block.size(); ++i) {
-            *(m_base_ptr+addr+i) = block[i];
+    void write_block(uint32_t addr, const uint32_t* block, size_t size) override {
+        check_range(addr, size);
+
+        volatile uint32_t* dst = m_base_ptr+addr;
+        size_t i(0);
+        switch (m_mode) {
+            case AccessMode::kBurst:
+#if defined(__ARM_NEON)
+                for( ; i<size && ((uintptr_t)(dst+i) & 0xf); ++i) {
+                    dst[i] = block[i];
+                }
+                for( ; i+4<=size; i+=4) {
+                    vst1q_u32((uint32_t*)(dst+i), vld1q_u32(block+i));
+                }
+                break;
+#else
+                [[fallthrough]];
+#endif
+            case AccessMode::k64:
+                if( i<size && ((uintptr_t)(dst+i) & 0x7) ) {
+                    dst[i] = block[i];
+                    ++i;
+                }
+                for( ; i+2<=size; i+=2) {
+                    uint64_t pair;
+                    ::memcpy(&pair, block+i, sizeof(pair));
+                    *(volatile uint64_t*)(dst+i) = pair;
+                }
+                break;
+            case AccessMode::k32:
+                break;
         }
+        for( ; i<size; ++i) {
+            dst[i] = block[i];
+        }
+
+        // The block is complete before the accesses following the call,
+        // e.g. the transactor status polling
+        io_barrier();
+    }
+
+    // Orders the accesses before and after the call
+    void barrier() {
+        io_barrier();
     }
 
 private:
@@ -79,25 +237,34 @@ private:
             return -1;
             // throw DevMemMappingError();
 
-	    size_t ptr = (size_t) mmap(NULL, m_addr_len*4, PROT_READ|PROT_WRITE, MAP_SHARED, m_dev_mem_fd, m_base_addr);
-	    if (ptr == -1) 
+	    void* ptr = mmap(NULL, m_addr_len*4, PROT_READ|PROT_WRITE, MAP_SHARED | (m_prefault ? MAP_POPULATE : 0), m_dev_mem_fd, m_base_addr);
+	    if (ptr == MAP_FAILED) {
+            ::close(m_dev_mem_fd);
             return -2;
-            // throw DevMemMappingError();
+        }
 
-        m_base_ptr = (uint32_t*)(ptr);
+        m_base_ptr = (volatile uint32_t*)(ptr);
         return 0;
     }
 
     int mem_unmap() {
-        munmap(m_base_ptr,m_addr_len*4);
+        munmap((void*)m_base_ptr,m_addr_len*4);
         ::close(m_dev_mem_fd);
         return 0;
     }   
 
+    void check_range(uint32_t addr, size_t size) const {
+        if ( addr > m_addr_len || size > m_addr_len - addr ) {
+            throw DevMemRangeError();
+        }
+    }
+
     int m_dev_mem_fd;
     size_t m_base_addr;
     size_t m_addr_len;
-    uint32_t* m_base_ptr;
+    AccessMode m_mode;
+    bool m_prefault;
+    volatile uint32_t* m_base_ptr;
 
 };
 
@@ -0,0 +1,314 @@
+#ifndef __EMUTRANSACTOR_HPP__
+#define __EMUTRANSACTOR_HPP__
+
+#include "DevMem.hpp"
+#include "hermesmodules/RegisterMap.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+
+namespace emu {
+
+struct EmuMappingError : public std::exception
+{
+    const char * what () const throw ()
+    {
+        return "Failed to map the register model of the emulated transactor";
+    }
+};
+
+// Words of memory, anonymous or backed by a file. A file keeps the values
+// after the process exits, and lets other processes inspect them.
+class MappedRegion {
+public:
+    MappedRegion(size_t n_words, const std::string& path) : m_size(n_words) {
+        int fd = -1;
+        int flags = MAP_SHARED;
+        if ( path.empty() ) {
+            flags |= MAP_ANONYMOUS;
+        } else {
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if ( fd < 0 ) {
+                throw EmuMappingError();
+            }
+            if ( ::ftruncate(fd, n_words * sizeof(uint32_t)) != 0 ) {
+                ::close(fd);
+                throw EmuMappingError();
+            }
+        }
+
+        void* ptr = ::mmap(NULL, n_words * sizeof(uint32_t), PROT_READ|PROT_WRITE, flags, fd, 0);
+        if ( fd >= 0 ) {
+            ::close(fd);
+        }
+        if ( ptr == MAP_FAILED ) {
+            throw EmuMappingError();
+        }
+        m_data = static_cast<uint32_t*>(ptr);
+    }
+
+    ~MappedRegion() {
+        ::munmap(m_data, m_size * sizeof(uint32_t));
+    }
+
+    MappedRegion(const MappedRegion&) = delete;
+    MappedRegion& operator=(const MappedRegion&) = delete;
+
+    uint32_t* data() { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    uint32_t* m_data = nullptr;
+    size_t m_size;
+};
+
+// Emulated ipbus transactor, for running the bridge on any Linux host.
+// As in the firmware, writes go to the request pages and reads come from
+// the status words and the reply pages. A worker thread executes the
+// requests, in the order their pages were written, against a register
+// model and publishes the replies and the replies count.
+class EmuTransactor : public devmem::Backend {
+public:
+    // Words of the register model, enough for the Hermes address tables
+    static constexpr size_t REGISTER_WORDS = 0x10000;
+
+    EmuTransactor(size_t addr_len, uint32_t num_bufs, uint32_t word_per_page, const std::string& regs_file, std::chrono::microseconds delay) :
+        m_addr_len(addr_len), m_num_bufs(num_bufs), m_word_per_page(word_per_page), m_delay(delay),
+        m_requests(num_bufs * word_per_page), m_replies(STATUS_LENGTH + num_bufs * word_per_page),
+        m_registers(REGISTER_WORDS, regs_file) {
+
+        if ( m_replies.size() > m_addr_len ) {
+            throw devmem::DevMemRangeError();
+        }
+        m_replies[0] = num_bufs;
+        m_replies[1] = word_per_page;
+        m_worker = std::thread(&EmuTransactor::run, this);
+    }
+
+    ~EmuTransactor() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        m_worker.join();
+    }
+
+    // Set a register of the model, e.g. the identification registers
+    void poke(uint32_t addr, uint32_t val) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if ( addr < m_registers.size() ) {
+            m_registers.data()[addr] = val;
+        }
+    }
+
+    size_t size() const override { return m_addr_len; }
+
+    uint32_t read(uint32_t addr) override {
+        uint32_t val;
+        this->read_block(addr, &val, 1);
+        return val;
+    }
+
+    void write(uint32_t addr, uint32_t val) override {
+        this->write_block(addr, &val, 1);
+    }
+
+    using Backend::read_block;
+    using Backend::write_block;
+
+    void read_block(uint32_t addr, uint32_t* block, size_t size) override {
+        this->check_range(addr, size);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for ( size_t i(0); i<size; ++i ) {
+            block[i] = addr+i < m_replies.size() ? m_replies[addr+i] : 0;
+        }
+    }
+
+    void write_block(uint32_t addr, const uint32_t* block, size_t size) override {
+        this->check_range(addr, size);
+        if ( size == 0 ) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for ( size_t i(0); i<size && addr+i < m_requests.size(); ++i ) {
+                m_requests[addr+i] = block[i];
+            }
+            if ( !this->request_complete(addr+size-1) ) {
+                return;
+            }
+            m_pending.push_back((addr+size-1) / m_word_per_page);
+        }
+        m_cv.notify_all();
+    }
+
+private:
+
+    static constexpr uint32_t STATUS_LENGTH = 4;
+
+    // IPbus transaction info codes
+    static constexpr uint32_t INFO_SUCCESS = 0x0;
+    static constexpr uint32_t INFO_BAD_HEADER = 0x1;
+    static constexpr uint32_t INFO_READ_ERROR = 0x4;
+    static constexpr uint32_t INFO_WRITE_ERROR = 0x5;
+
+    void check_range(uint32_t addr, size_t size) const {
+        if ( addr > m_addr_len || size > m_addr_len - addr ) {
+            throw devmem::DevMemRangeError();
+        }
+    }
+
+    // The request of a page is complete once the last word announced by its
+    // header is written
+    bool request_complete(uint32_t last) const {
+        if ( last >= m_requests.size() ) {
+            return false;
+        }
+        uint32_t base = (last / m_word_per_page) * m_word_per_page;
+        uint32_t hdr = m_requests[base];
+        uint32_t n_words = ((hdr >> 16) & 0xffff) + (hdr & 0xffff);
+        return (hdr >> 16) != 0 && last == base + n_words;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while ( !m_stop ) {
+            if ( m_pending.empty() ) {
+                m_cv.wait(lock);
+                continue;
+            }
+            uint32_t page = m_pending.front();
+            m_pending.pop_front();
+
+            if ( m_delay.count() > 0 ) {
+                lock.unlock();
+                std::this_thread::sleep_for(m_delay);
+                lock.lock();
+            }
+            this->execute(page);
+        }
+    }
+
+    // Execute the request of a page and publish its reply
+    void execute(uint32_t page) {
+        const uint32_t* req = &m_requests[page * m_word_per_page];
+        uint32_t n_words = std::min<uint32_t>(((req[0] >> 16) & 0xffff) + (req[0] & 0xffff), m_word_per_page - 1);
+
+        m_reply.clear();
+        this->execute_packet(req+1, n_words, m_reply);
+        if ( m_reply.size() > m_word_per_page - 1 ) {
+            m_reply.resize(m_word_per_page - 1);
+        }
+
+        uint32_t* rep = &m_replies[STATUS_LENGTH + page * m_word_per_page];
+        rep[0] = (1u << 16) | (m_reply.size() - 1);
+        std::copy(m_reply.begin(), m_reply.end(), rep+1);
+
+        m_replies[2] = (page + 1) % m_num_bufs;
+        ++m_replies[3];
+    }
+
+    // Execute the transactions of an IPbus control packet, stopping at the
+    // first one that fails, as the firmware does
+    void execute_packet(const uint32_t* pkt, size_t n, std::vector<uint32_t>& reply) {
+        using namespace dunedaq::hermesmodules::regmap::ipbus;
+
+        reply.push_back(pkt[0]);
+        uint32_t* regs = m_registers.data();
+        size_t n_regs = m_registers.size();
+
+        size_t i(1);
+        while ( i < n ) {
+            uint32_t hdr = pkt[i++];
+            uint32_t n_trans = (hdr >> 8) & 0xff;
+            uint32_t type = (hdr >> 4) & 0xf;
+            size_t hdr_pos = reply.size();
+            reply.push_back((hdr & ~0xfu) | INFO_SUCCESS);
+
+            if ( (hdr >> 28) != k_protocol_version || i >= n ) {
+                reply[hdr_pos] = (hdr & ~0xfu) | INFO_BAD_HEADER;
+                return;
+            }
+            uint32_t addr = pkt[i++];
+
+            bool incremental = (type == kRead || type == kWrite);
+            size_t last = incremental ? size_t(addr) + n_trans : size_t(addr) + 1;
+            if ( n_trans > 0 && last > n_regs ) {
+                reply[hdr_pos] = (hdr & ~0xfu) | ((type == kRead || type == kNonIncRead) ? INFO_READ_ERROR : INFO_WRITE_ERROR);
+                return;
+            }
+
+            switch (type) {
+                case kRead:
+                case kNonIncRead:
+                    for ( uint32_t k(0); k<n_trans; ++k ) {
+                        reply.push_back(regs[incremental ? addr+k : addr]);
+                    }
+                    break;
+                case kWrite:
+                case kNonIncWrite:
+                    if ( i + n_trans > n ) {
+                        reply[hdr_pos] = (hdr & ~0xfu) | INFO_BAD_HEADER;
+                        return;
+                    }
+                    for ( uint32_t k(0); k<n_trans; ++k ) {
+                        regs[incremental ? addr+k : addr] = pkt[i++];
+                    }
+                    break;
+                case kRMWBits:
+                    if ( i + 2 > n || addr >= n_regs ) {
+                        reply[hdr_pos] = (hdr & ~0xfu) | INFO_BAD_HEADER;
+                        return;
+                    }
+                    reply.push_back(regs[addr]);
+                    regs[addr] = (regs[addr] & pkt[i]) | pkt[i+1];
+                    i += 2;
+                    break;
+                case kRMWSum:
+                    if ( i + 1 > n || addr >= n_regs ) {
+                        reply[hdr_pos] = (hdr & ~0xfu) | INFO_BAD_HEADER;
+                        return;
+                    }
+                    reply.push_back(regs[addr]);
+                    regs[addr] += pkt[i++];
+                    break;
+                default:
+                    reply[hdr_pos] = (hdr & ~0xfu) | INFO_BAD_HEADER;
+                    return;
+            }
+        }
+    }
+
+    size_t m_addr_len;
+    uint32_t m_num_bufs;
+    uint32_t m_word_per_page;
+    std::chrono::microseconds m_delay;
+
+    // Pages written by the bridge, and status words and pages it reads
+    std::vector<uint32_t> m_requests;
+    std::vector<uint32_t> m_replies;
+    MappedRegion m_registers;
+    std::vector<uint32_t> m_reply;
+
+    // Pages with a complete request, in the order they were written
+    std::deque<uint32_t> m_pending;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop = false;
+    std::thread m_worker;
+};
+
+}
+#endif
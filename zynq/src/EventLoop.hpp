@@ -0,0 +1,184 @@
+#ifndef __EVENTLOOP_HPP__
+#define __EVENTLOOP_HPP__
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <vector>
+
+
+namespace event {
+
+struct EventLoopError : public std::exception
+{
+    const char * what () const throw ()
+    {
+        return "Event loop system call failed";
+    }
+};
+
+// Single-threaded event loop on epoll. Sockets, timers (timerfd) and
+// signals (signalfd) are all file descriptors, their handlers are called
+// from run_once.
+class EventLoop {
+public:
+    using Handler = std::function<void(uint32_t events)>;
+
+    EventLoop() {
+        m_epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        if ( m_epoll_fd < 0 ) {
+            throw EventLoopError();
+        }
+    }
+
+    ~EventLoop() {
+        for ( int fd : m_owned_fds ) {
+            ::close(fd);
+        }
+        ::close(m_epoll_fd);
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // The epoll descriptor is readable when an event is pending
+    int get_fd() const { return m_epoll_fd; }
+
+    void add_fd(int fd, Handler handler, uint32_t events = EPOLLIN) {
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+        if ( ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0 ) {
+            throw EventLoopError();
+        }
+        m_handlers[fd] = std::move(handler);
+        m_events[fd] = events;
+    }
+
+    // Change the events watched on fd, none to pause it
+    void set_events(int fd, uint32_t events) {
+        if ( m_events[fd] == events ) {
+            return;
+        }
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+        if ( ::epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0 ) {
+            throw EventLoopError();
+        }
+        m_events[fd] = events;
+    }
+
+    void remove_fd(int fd) {
+        ::epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        m_handlers.erase(fd);
+        m_events.erase(fd);
+    }
+
+    // Call handler every period
+    void add_timer(std::chrono::nanoseconds period, std::function<void()> handler) {
+        int fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if ( fd < 0 ) {
+            throw EventLoopError();
+        }
+        m_owned_fds.push_back(fd);
+
+        itimerspec spec = {};
+        spec.it_interval.tv_sec = period.count() / 1000000000;
+        spec.it_interval.tv_nsec = period.count() % 1000000000;
+        spec.it_value = spec.it_interval;
+        if ( ::timerfd_settime(fd, 0, &spec, nullptr) < 0 ) {
+            throw EventLoopError();
+        }
+
+        this->add_fd(fd, [fd, handler](uint32_t) {
+            uint64_t expirations;
+            if ( ::read(fd, &expirations, sizeof(expirations)) == sizeof(expirations) ) {
+                handler();
+            }
+        });
+    }
+
+    // Block the signals and call handler for them from the loop instead.
+    // Threads started afterwards inherit the mask, those started before
+    // may still receive the signals.
+    void add_signals(std::initializer_list<int> signals, std::function<void(int)> handler) {
+        sigset_t mask;
+        sigemptyset(&mask);
+        for ( int sig : signals ) {
+            sigaddset(&mask, sig);
+        }
+        if ( ::pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0 ) {
+            throw EventLoopError();
+        }
+
+        int fd = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if ( fd < 0 ) {
+            throw EventLoopError();
+        }
+        m_owned_fds.push_back(fd);
+
+        this->add_fd(fd, [fd, handler](uint32_t) {
+            signalfd_siginfo info;
+            while ( ::read(fd, &info, sizeof(info)) == sizeof(info) ) {
+                handler(info.ssi_signo);
+            }
+        });
+    }
+
+    // True if an event is pending, without handling it
+    bool pending() const {
+        pollfd pfd = { m_epoll_fd, POLLIN, 0 };
+        return ::poll(&pfd, 1, 0) > 0;
+    }
+
+    // Wait for events for at most timeout, negative to wait forever, and
+    // call their handlers. Returns the number of events handled.
+    int run_once(std::chrono::milliseconds timeout) {
+        epoll_event events[k_max_events];
+        int n = ::epoll_wait(m_epoll_fd, events, k_max_events, timeout.count() < 0 ? -1 : timeout.count());
+        if ( n < 0 ) {
+            if ( errno == EINTR ) {
+                return 0;
+            }
+            throw EventLoopError();
+        }
+
+        for ( int i(0); i<n; ++i ) {
+            // A previous handler may have removed it
+            auto it = m_handlers.find(events[i].data.fd);
+            if ( it != m_handlers.end() ) {
+                it->second(events[i].events);
+            }
+        }
+        return n;
+    }
+
+    void stop() { m_stopped = true; }
+
+    bool stopped() const { return m_stopped; }
+
+private:
+
+    static constexpr int k_max_events = 16;
+
+    int m_epoll_fd = -1;
+    std::map<int, Handler> m_handlers;
+    std::map<int, uint32_t> m_events;
+    // Timer and signal descriptors created by the loop
+    std::vector<int> m_owned_fds;
+    bool m_stopped = false;
+};
+
+}
+#endif
@@ -0,0 +1,281 @@
+#ifndef __IPBUSPACKET_HPP__
+#define __IPBUSPACKET_HPP__
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace ipbus {
+
+static constexpr uint32_t PROTOCOL_VERSION = 0x2;
+
+enum PacketType : uint32_t {
+    kControl = 0x0,
+    kStatus = 0x1,
+    kResend = 0x2,
+};
+
+// Words of a status request and of its reply
+static constexpr size_t STATUS_PACKET_WORDS = 16;
+
+// Events of the status traffic history
+enum TrafficEvent : uint8_t {
+    kNoEvent = 0x0,
+    kForwarded = 0x1,
+    kStatusServed = 0x2,
+    kResendServed = 0x3,
+    kDropped = 0x4,
+    kMalformed = 0x5,
+};
+
+struct PacketHeader {
+    uint16_t id = 0;
+    uint32_t type = kControl;
+    // The packet was sent in the other byte order
+    bool swapped = false;
+};
+
+inline uint32_t byte_swap(uint32_t w) {
+    return __builtin_bswap32(w);
+}
+
+inline uint32_t packet_header(uint16_t id, uint32_t type) {
+    return (PROTOCOL_VERSION << 28) | (uint32_t(id) << 8) | 0xf0 | (type & 0xf);
+}
+
+// Parse an IPbus 2.0 packet header, in either byte order
+inline bool parse_header(uint32_t word, PacketHeader& h) {
+    for ( bool swapped : {false, true} ) {
+        uint32_t w = swapped ? byte_swap(word) : word;
+        if ( (w >> 28) == PROTOCOL_VERSION && (w & 0xf0) == 0xf0 ) {
+            h.id = (w >> 8) & 0xffff;
+            h.type = w & 0xf;
+            h.swapped = swapped;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Packet IDs go from 1 to 0xffff, 0 is for packets outside of the sequence
+inline uint16_t next_id(uint16_t id) {
+    return id == 0xffff ? 1 : id + 1;
+}
+
+// Reliability layer of an IPbus 2.0 UDP target, in front of a transactor
+// executing the control packets:
+// - status packets are answered locally;
+// - control packets are forwarded only if they carry the next expected
+//   packet ID; duplicates and unexpected IDs are dropped;
+// - the replies of the last n_buffers control packets are kept in a ring
+//   indexed by packet ID, and resend requests answered from it.
+// Control packets with ID 0 are forwarded without any check.
+class PacketTracker {
+public:
+
+    enum class Action {
+        kForward,  // send the packet to the transactor
+        kReply,    // send the reply prepared by the tracker
+        kDrop,     // ignore the packet
+    };
+
+    struct Stats {
+        uint64_t n_forwarded = 0;
+        uint64_t n_unreliable = 0;
+        uint64_t n_status = 0;
+        uint64_t n_resends = 0;
+        uint64_t n_resends_missed = 0;
+        uint64_t n_duplicates = 0;
+        uint64_t n_unexpected = 0;
+        uint64_t n_malformed = 0;
+        uint64_t n_rewinds = 0;
+    };
+
+    PacketTracker(size_t n_buffers, uint32_t mtu, size_t max_reply_words, bool check_ids) :
+        m_mtu(mtu), m_check_ids(check_ids), m_ring(n_buffers) {
+        for ( auto& e : m_ring ) {
+            e.reply.reserve(max_reply_words);
+        }
+    }
+
+    size_t n_buffers() const { return m_ring.size(); }
+
+    uint16_t next_expected_id() const { return m_next_id; }
+
+    const Stats& stats() const { return m_stats; }
+
+    // Decide what to do with a request. For Action::kReply the reply is
+    // written in the caller's buffer of capacity words.
+    Action on_request(const uint32_t* request, size_t size, uint32_t* reply, size_t capacity, size_t& reply_size) {
+
+        PacketHeader h;
+        if ( size == 0 || !parse_header(request[0], h) ) {
+            ++m_stats.n_malformed;
+            this->record_event(kMalformed);
+            return Action::kDrop;
+        }
+
+        switch (h.type) {
+            case kStatus:
+                if ( capacity < STATUS_PACKET_WORDS ) {
+                    ++m_stats.n_malformed;
+                    this->record_event(kMalformed);
+                    return Action::kDrop;
+                }
+                ++m_stats.n_status;
+                this->record_event(kStatusServed);
+                this->fill_status(reply, h.swapped);
+                reply_size = STATUS_PACKET_WORDS;
+                return Action::kReply;
+
+            case kResend: {
+                const Entry* e = this->find(h.id);
+                if ( !e || e->state != Entry::kDone || e->reply.size() > capacity ) {
+                    // Not sent yet, or too old: the request will time out again
+                    ++m_stats.n_resends_missed;
+                    this->record_event(kDropped);
+                    return Action::kDrop;
+                }
+                ++m_stats.n_resends;
+                this->record_event(kResendServed);
+                std::copy(e->reply.begin(), e->reply.end(), reply);
+                reply_size = e->reply.size();
+                return Action::kReply;
+            }
+
+            case kControl:
+                if ( h.id == 0 ) {
+                    ++m_stats.n_unreliable;
+                    this->record_event(kForwarded);
+                    return Action::kForward;
+                }
+
+                if ( m_check_ids && h.id != m_next_id ) {
+                    if ( this->find(h.id) ) {
+                        ++m_stats.n_duplicates;
+                    } else {
+                        ++m_stats.n_unexpected;
+                    }
+                    this->record_event(kDropped);
+                    return Action::kDrop;
+                }
+
+                ++m_stats.n_forwarded;
+                this->record_event(kForwarded);
+                this->record_header(m_received, packet_header(h.id, h.type));
+
+                // The slot is taken over, its previous reply can no longer be resent
+                {
+                    Entry& e = m_ring[h.id % m_ring.size()];
+                    e.id = h.id;
+                    e.state = Entry::kInFlight;
+                    e.reply.clear();
+                }
+                m_next_id = next_id(h.id);
+                return Action::kForward;
+
+            default:
+                ++m_stats.n_malformed;
+                this->record_event(kMalformed);
+                return Action::kDrop;
+        }
+    }
+
+    // Keep the reply of a forwarded control packet for resends
+    void on_reply(const uint32_t* reply, size_t size) {
+        PacketHeader h;
+        if ( size == 0 || !parse_header(reply[0], h) || h.type != kControl || h.id == 0 ) {
+            return;
+        }
+        this->record_header(m_sent, packet_header(h.id, h.type));
+
+        Entry& e = m_ring[h.id % m_ring.size()];
+        if ( e.id != h.id || e.state != Entry::kInFlight ) {
+            return;
+        }
+        e.reply.assign(reply, reply+size);
+        e.state = Entry::kDone;
+    }
+
+    // The control packet id was forwarded but its reply is lost, e.g. on a
+    // transactor timeout. The packet and those after it are expected again,
+    // so that the client sends them again instead of asking for replies
+    // that will never come.
+    void on_lost(uint16_t id) {
+        Entry& e = m_ring[id % m_ring.size()];
+        if ( id == 0 || e.id != id || e.state != Entry::kInFlight ) {
+            return;
+        }
+
+        for ( uint16_t i(id); i != m_next_id; i = next_id(i) ) {
+            Entry& f = m_ring[i % m_ring.size()];
+            if ( f.id == i ) {
+                f.state = Entry::kEmpty;
+            }
+        }
+        m_next_id = id;
+        ++m_stats.n_rewinds;
+    }
+
+private:
+
+    struct Entry {
+        enum State { kEmpty, kInFlight, kDone };
+        uint16_t id = 0;
+        State state = kEmpty;
+        std::vector<uint32_t> reply;
+    };
+
+    const Entry* find(uint16_t id) const {
+        const Entry& e = m_ring[id % m_ring.size()];
+        return (id != 0 && e.id == id && e.state != Entry::kEmpty) ? &e : nullptr;
+    }
+
+    void record_event(TrafficEvent ev) {
+        // Most recent event in the most significant byte of the first word
+        for ( size_t i(m_traffic.size()-1); i>0; --i ) {
+            m_traffic[i] = (m_traffic[i] >> 8) | (m_traffic[i-1] << 24);
+        }
+        m_traffic[0] = (m_traffic[0] >> 8) | (uint32_t(ev) << 24);
+    }
+
+    static void record_header(std::array<uint32_t, 4>& history, uint32_t header) {
+        std::copy_backward(history.begin(), history.end()-1, history.end());
+        history[0] = header;
+    }
+
+    void fill_status(uint32_t* reply, bool swapped) const {
+        reply[0] = packet_header(0, kStatus);
+        reply[1] = m_mtu;
+        reply[2] = m_ring.size();
+        reply[3] = packet_header(m_next_id, kControl);
+        std::copy(m_traffic.begin(), m_traffic.end(), reply+4);
+        std::copy(m_received.begin(), m_received.end(), reply+8);
+        std::copy(m_sent.begin(), m_sent.end(), reply+12);
+
+        if ( swapped ) {
+            for ( size_t i(0); i<STATUS_PACKET_WORDS; ++i ) {
+                reply[i] = byte_swap(reply[i]);
+            }
+        }
+    }
+
+    uint32_t m_mtu;
+    bool m_check_ids;
+    uint16_t m_next_id = 1;
+
+    std::vector<Entry> m_ring;
+
+    // Status histories, most recent first
+    std::array<uint32_t, 4> m_traffic{};
+    std::array<uint32_t, 4> m_received{};
+    std::array<uint32_t, 4> m_sent{};
+
+    Stats m_stats;
+};
+
+}
+#endif
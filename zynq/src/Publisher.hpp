@@ -0,0 +1,290 @@
+#ifndef __PUBLISHER_HPP__
+#define __PUBLISHER_HPP__
+
+#include "UDPSocket.hpp"
+#include "hermesmodules/HermesRegisterMap.hpp"
+
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+namespace publish {
+
+// Snapshot datagram, little-endian 32-bit words:
+//   0     SNAPSHOT_MAGIC
+//   1     sequence number, incremented at every snapshot
+//   2-3   host time of the sample, ns since the epoch, low word first
+//   4-5   firmware time of the sample (samp_ts), low word first
+//   6     number of values n
+//   7...  the n register values, in the configured order
+static constexpr uint32_t SNAPSHOT_MAGIC = 0x48534e50;
+static constexpr size_t SNAPSHOT_HEADER_WORDS = 7;
+
+// Samples a list of registers at a fixed period and pushes the values to
+// the subscribed endpoints.
+//
+// Clients subscribe by sending "SUB" to the publish port, and are answered
+// with "OK <period ms> <lease s> <address>...". A subscription expires
+// after the lease unless renewed with another "SUB"; "UNSUB" ends it.
+//
+// The registers are read with a single IPbus packet through the
+// transactor: the counters are latched by a samp pulse, then the latch
+// time and the registers are read. Samples are only taken while there
+// are subscribers.
+class Publisher {
+public:
+    struct Stats {
+        uint64_t n_samples = 0;
+        uint64_t n_failed = 0;
+        // Periods skipped because the previous sample had not completed
+        uint64_t n_overruns = 0;
+        uint64_t n_subscribes = 0;
+        uint64_t n_expired = 0;
+    };
+
+    static constexpr size_t MAX_SUBSCRIBERS = 16;
+
+    Publisher(UDPSocket& sock, const std::vector<uint32_t>& addrs, std::chrono::milliseconds period, std::chrono::seconds lease) :
+        m_sock(sock), m_addrs(addrs), m_period(period), m_lease(lease) {
+
+        namespace regmap = dunedaq::hermesmodules::regmap;
+        using namespace regmap::ipbus;
+
+        // Packet ID 0: outside of the sequence of the clients
+        m_request = { packet_header(0) };
+        queue_write<regmap::samp::ctrl::samp>(m_request, 0, 1);
+        queue_write<regmap::samp::ctrl::samp>(m_request, 1, 0);
+        queue_read<regmap::samp::samp_ts_l>(m_request, 2);
+        queue_read<regmap::samp::samp_ts_h>(m_request, 3);
+        for ( size_t i(0); i<m_addrs.size(); ++i ) {
+            m_request.push_back(transaction_header(4+i, 1, kRead));
+            m_request.push_back(m_addrs[i]);
+        }
+
+        m_snapshot.resize(SNAPSHOT_HEADER_WORDS + m_addrs.size());
+        m_snapshot[0] = SNAPSHOT_MAGIC;
+        m_snapshot[6] = m_addrs.size();
+    }
+
+    // Sampling packet, to be executed by the transactor
+    const std::vector<uint32_t>& request() const { return m_request; }
+
+    // Words of the reply to the sampling packet: the packet header, then a
+    // transaction header and a word for each samp write and each read. The
+    // samp writes are replied with a word as RMWBits, samp being a partial
+    // field.
+    static_assert(!dunedaq::hermesmodules::regmap::Register<dunedaq::hermesmodules::regmap::samp::ctrl::samp>::is_full_word,
+                  "samp must be a partial field, written with RMWBits");
+    size_t reply_words() const { return 1 + 2 * (4 + m_addrs.size()); }
+
+    std::chrono::milliseconds period() const { return m_period; }
+
+    size_t n_subscribers() const { return m_subscribers.size(); }
+
+    const Stats& stats() const { return m_stats; }
+
+    // Handle the subscription requests
+    void on_readable() {
+        char msg[64];
+        UDPSocket::IPv4 peer;
+        int n;
+        while ( (n = this->receive(msg, sizeof(msg), peer)) >= 0 ) {
+            std::string cmd(msg, n);
+            while ( !cmd.empty() && std::isspace((unsigned char)cmd.back()) ) {
+                cmd.pop_back();
+            }
+
+            if ( cmd == "SUB" ) {
+                this->subscribe(peer);
+            } else if ( cmd == "UNSUB" ) {
+                this->unsubscribe(peer);
+                this->send_text("BYE\n", peer);
+            } else {
+                this->send_text("ERR unknown command\n", peer);
+            }
+        }
+    }
+
+    // Called every period: expire the leases, and ask for a sample
+    void on_tick() {
+        auto now = Clock::now();
+        for ( auto it = m_subscribers.begin(); it != m_subscribers.end(); ) {
+            if ( now > it->expiry ) {
+                ++m_stats.n_expired;
+                it = m_subscribers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        if ( m_subscribers.empty() ) {
+            return;
+        }
+        if ( m_due || m_in_flight ) {
+            ++m_stats.n_overruns;
+            return;
+        }
+        m_due = true;
+    }
+
+    // A sample is to be submitted to the transactor
+    bool due() const { return m_due; }
+
+    void on_submitted() {
+        m_due = false;
+        m_in_flight = true;
+        m_sample_time = std::chrono::system_clock::now();
+    }
+
+    // Reply to the sampling packet, or nullptr if it was lost
+    void on_reply(const uint32_t* reply, size_t size) {
+        m_in_flight = false;
+
+        if ( reply == nullptr || size < this->reply_words() ) {
+            ++m_stats.n_failed;
+            return;
+        }
+        // Every transaction must have succeeded
+        for ( size_t i(1); i<this->reply_words(); i+=2 ) {
+            if ( (reply[i] & 0xf) != 0 ) {
+                ++m_stats.n_failed;
+                return;
+            }
+        }
+
+        uint64_t host_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(m_sample_time.time_since_epoch()).count();
+        m_snapshot[1] = m_seq++;
+        m_snapshot[2] = host_ns & 0xffffffff;
+        m_snapshot[3] = host_ns >> 32;
+        // Replies of the two samp writes, then the reads
+        m_snapshot[4] = reply[6];
+        m_snapshot[5] = reply[8];
+        for ( size_t i(0); i<m_addrs.size(); ++i ) {
+            m_snapshot[SNAPSHOT_HEADER_WORDS+i] = reply[10 + 2*i];
+        }
+
+        m_dgrams.resize(m_subscribers.size());
+        for ( size_t i(0); i<m_subscribers.size(); ++i ) {
+            m_dgrams[i].data = m_snapshot.data();
+            m_dgrams[i].size = m_snapshot.size() * sizeof(uint32_t);
+            m_dgrams[i].peer = &m_subscribers[i].peer;
+        }
+        try {
+            m_sock.send_many(m_dgrams.data(), m_dgrams.size());
+        } catch (udp::SendError& e) {
+            std::cerr << "Error while sending a snapshot" << std::endl;
+        }
+        ++m_stats.n_samples;
+    }
+
+    void print_stats(std::ostream& os) const {
+        os << "Publish: subscribers " << m_subscribers.size()
+           << ", samples " << m_stats.n_samples
+           << ", failed " << m_stats.n_failed
+           << ", overruns " << m_stats.n_overruns
+           << ", subscribes " << m_stats.n_subscribes
+           << ", expired " << m_stats.n_expired << std::endl;
+    }
+
+    void write_json(std::ostream& os) const {
+        os << "{\"subscribers\":" << m_subscribers.size()
+           << ",\"samples\":" << m_stats.n_samples
+           << ",\"failed\":" << m_stats.n_failed
+           << ",\"overruns\":" << m_stats.n_overruns
+           << ",\"subscribes\":" << m_stats.n_subscribes
+           << ",\"expired\":" << m_stats.n_expired << "}";
+    }
+
+private:
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Subscriber {
+        UDPSocket::IPv4 peer;
+        Clock::time_point expiry;
+    };
+
+    static bool same_peer(const UDPSocket::IPv4& a, const UDPSocket::IPv4& b) {
+        return a.octets == b.octets && a.port == b.port;
+    }
+
+    void subscribe(const UDPSocket::IPv4& peer) {
+        ++m_stats.n_subscribes;
+        auto expiry = Clock::now() + m_lease;
+        for ( auto& s : m_subscribers ) {
+            if ( same_peer(s.peer, peer) ) {
+                s.expiry = expiry;
+                this->send_ack(peer);
+                return;
+            }
+        }
+        if ( m_subscribers.size() >= MAX_SUBSCRIBERS ) {
+            this->send_text("ERR too many subscribers\n", peer);
+            return;
+        }
+        m_subscribers.push_back({peer, expiry});
+        this->send_ack(peer);
+    }
+
+    void unsubscribe(const UDPSocket::IPv4& peer) {
+        for ( auto it = m_subscribers.begin(); it != m_subscribers.end(); ++it ) {
+            if ( same_peer(it->peer, peer) ) {
+                m_subscribers.erase(it);
+                return;
+            }
+        }
+    }
+
+    void send_ack(const UDPSocket::IPv4& peer) {
+        std::ostringstream os;
+        os << "OK " << m_period.count() << " " << m_lease.count() << std::hex;
+        for ( uint32_t a : m_addrs ) {
+            os << " 0x" << a;
+        }
+        os << "\n";
+        this->send_text(os.str(), peer);
+    }
+
+    void send_text(const std::string& text, const UDPSocket::IPv4& peer) {
+        try {
+            m_sock.send_from(text.data(), text.size(), peer);
+        } catch (udp::SendError& e) {
+            std::cerr << "Error while answering a subscription request" << std::endl;
+        }
+    }
+
+    int receive(char* msg, size_t capacity, UDPSocket::IPv4& peer) {
+        try {
+            return m_sock.recv_into(msg, capacity, peer);
+        } catch (udp::RecvError& e) {
+            std::cerr << "Error while receiving a subscription request" << std::endl;
+            return -1;
+        }
+    }
+
+    UDPSocket& m_sock;
+    std::vector<uint32_t> m_addrs;
+    std::chrono::milliseconds m_period;
+    std::chrono::seconds m_lease;
+
+    std::vector<uint32_t> m_request;
+    std::vector<uint32_t> m_snapshot;
+    std::vector<Subscriber> m_subscribers;
+    std::vector<UDPSocket::Datagram> m_dgrams;
+
+    bool m_due = false;
+    bool m_in_flight = false;
+    std::chrono::system_clock::time_point m_sample_time;
+    uint32_t m_seq = 0;
+
+    Stats m_stats;
+};
+
+}
+#endif
@@ -0,0 +1,138 @@
+#ifndef __REALTIME_HPP__
+#define __REALTIME_HPP__
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <vector>
+
+
+namespace rt {
+
+// Scheduling and memory settings of the bridge process, for a latency
+// that does not depend on the other software running on the board
+struct Config {
+    // CPUs the bridge thread may run on, all if empty
+    std::vector<int> cpus;
+    // SCHED_FIFO priority, 0 for the default scheduling
+    int rt_prio = 0;
+    // Lock the current and future pages in memory
+    bool mlock = false;
+    // Fault in the mapped window and the stack before serving requests
+    bool prefault = false;
+};
+
+// Parse a CPU list, e.g. "1", "0,1" or "0-3"
+inline bool parse_cpu_list(const std::string& list, std::vector<int>& cpus) {
+    std::istringstream in(list);
+    std::string item;
+    while ( std::getline(in, item, ',') ) {
+        try {
+            size_t dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash+1));
+            if ( first < 0 || last < first || last >= CPU_SETSIZE ) {
+                return false;
+            }
+            for ( int c(first); c<=last; ++c ) {
+                cpus.push_back(c);
+            }
+        } catch (std::exception& e) {
+            return false;
+        }
+    }
+    return !cpus.empty();
+}
+
+// Touch the stack the bridge may use, so that it does not fault while
+// serving requests
+inline void prefault_stack() {
+    static constexpr size_t k_stack_prefault = 256 * 1024;
+    volatile uint8_t stack[k_stack_prefault];
+    for ( size_t i(0); i<k_stack_prefault; i+=4096 ) {
+        stack[i] = 0;
+    }
+    // Read back, so that the stores are not dropped with the array
+    (void)stack[0];
+}
+
+// Apply the settings to the calling thread. Settings that cannot be
+// applied, e.g. without the privileges, are reported and left out:
+// the bridge still serves requests, with the default settings.
+inline void apply(const Config& cfg) {
+    if ( !cfg.cpus.empty() ) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for ( int c : cfg.cpus ) {
+            CPU_SET(c, &set);
+        }
+        if ( ::sched_setaffinity(0, sizeof(set), &set) != 0 ) {
+            std::cerr << "WARNING: failed to set the CPU affinity: " << ::strerror(errno) << std::endl;
+        }
+    }
+
+    if ( cfg.rt_prio > 0 ) {
+        sched_param param = {};
+        param.sched_priority = cfg.rt_prio;
+        if ( ::sched_setscheduler(0, SCHED_FIFO, &param) != 0 ) {
+            std::cerr << "WARNING: failed to set SCHED_FIFO priority " << cfg.rt_prio << ": " << ::strerror(errno) << std::endl;
+        }
+    }
+
+    if ( cfg.mlock ) {
+        if ( ::mlockall(MCL_CURRENT | MCL_FUTURE) != 0 ) {
+            std::cerr << "WARNING: failed to lock the memory: " << ::strerror(errno) << std::endl;
+        }
+    }
+
+    if ( cfg.prefault ) {
+        prefault_stack();
+    }
+}
+
+// Value of a field of /proc/self/status, e.g. VmLck
+inline std::string proc_status(const std::string& field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while ( std::getline(status, line) ) {
+        if ( line.compare(0, field.size()+1, field + ":") == 0 ) {
+            size_t start = line.find_first_not_of(" \t", field.size()+1);
+            return start == std::string::npos ? "" : line.substr(start);
+        }
+    }
+    return "unknown";
+}
+
+// Print the settings in effect, which may differ from those asked for
+inline void print_settings(std::ostream& os) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    os << " - CPU affinity:";
+    if ( ::sched_getaffinity(0, sizeof(set), &set) == 0 ) {
+        for ( int c(0); c<CPU_SETSIZE; ++c ) {
+            if ( CPU_ISSET(c, &set) ) {
+                os << " " << c;
+            }
+        }
+    } else {
+        os << " unknown";
+    }
+    os << std::endl;
+
+    int policy = ::sched_getscheduler(0);
+    sched_param param = {};
+    ::sched_getparam(0, &param);
+    os << " - Scheduling: " << (policy == SCHED_FIFO ? "SCHED_FIFO" : policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER")
+       << ", priority " << param.sched_priority << std::endl;
+
+    os << " - Memory locked: " << proc_status("VmLck") << ", resident: " << proc_status("VmRSS") << std::endl;
+}
+
+}
+#endif
@@ -0,0 +1,211 @@
+#ifndef __TRANSACTOR_HPP__
+#define __TRANSACTOR_HPP__
+
+#include "DevMem.hpp"
+#include "Completion.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+namespace transactor {
+
+struct InvalidStatusError : public std::exception
+{
+    const char * what () const throw ()
+    {
+        return "Invalid ipbus transactor status";
+    }
+};
+
+// Status words of the ipbus transactor
+static constexpr uint32_t STATUS_NUM_BUFS = 0;
+static constexpr uint32_t STATUS_WORD_PER_PAGE = 1;
+static constexpr uint32_t STATUS_NEXT_REQ_PAGE = 2;
+static constexpr uint32_t STATUS_NUM_REPLIES = 3;
+static constexpr uint32_t STATUS_LENGTH = 4;
+
+static constexpr uint32_t HEADER_LENGTH = 0x1;
+
+// Keeps up to num_bufs requests in flight in the transactor pages.
+// Requests are written to consecutive pages, and the transactor publishes
+// their replies in the same order: the reply of the oldest request is
+// complete once the replies count has moved past it.
+// Without the replies count there is no way to tell which reply is
+// complete, a single request is in flight and its reply is read after a
+// fixed delay.
+class Transactor {
+public:
+    Transactor(devmem::Backend& mem, completion::Waiter& waiter, uint32_t max_depth, bool check_replies_count) :
+        m_mem(mem), m_waiter(waiter), m_max_depth(max_depth), m_check_replies_count(check_replies_count) {
+        this->sync();
+    }
+
+    // Re-read the transactor status, forgetting the requests in flight
+    void sync() {
+        auto status = m_mem.read_block(0, STATUS_LENGTH);
+        m_num_bufs = status[STATUS_NUM_BUFS];
+        m_word_per_page = status[STATUS_WORD_PER_PAGE];
+        m_next_page = status[STATUS_NEXT_REQ_PAGE];
+        m_num_replies = status[STATUS_NUM_REPLIES];
+        m_submitted.clear();
+        m_published = 0;
+
+        if ( m_num_bufs == 0 || m_word_per_page <= HEADER_LENGTH || m_next_page >= m_num_bufs ) {
+            throw InvalidStatusError();
+        }
+
+        m_depth = m_check_replies_count ? std::max<uint32_t>(1, std::min(m_num_bufs, m_max_depth)) : 1;
+    }
+
+    completion::Waiter& waiter() const { return m_waiter; }
+
+    uint32_t num_bufs() const { return m_num_bufs; }
+    uint32_t word_per_page() const { return m_word_per_page; }
+
+    // Number of requests that can be in flight
+    uint32_t depth() const { return m_depth; }
+
+    uint32_t in_flight() const { return m_submitted.size(); }
+
+    bool can_submit() const { return this->in_flight() < m_depth; }
+
+    // Largest request, in words, that fits in a page
+    uint32_t max_request_words() const { return m_word_per_page - HEADER_LENGTH; }
+
+    // Largest reply, in words
+    uint32_t max_reply_words() const { return m_word_per_page - HEADER_LENGTH; }
+
+    bool submit(const std::vector<uint32_t>& request) {
+        return this->submit(request.data(), request.size());
+    }
+
+    // Write a request to the next page. Returns false if it does not fit in a page.
+    bool submit(const uint32_t* request, size_t n_words) {
+        if ( n_words == 0 || n_words > this->max_request_words() ) {
+            return false;
+        }
+
+        uint32_t page = (m_next_page + this->in_flight()) % m_num_bufs;
+        uint32_t req_base_addr = m_word_per_page * page;
+
+        // Header word
+        uint32_t pyld_size = n_words - 1;
+        uint32_t req_hdr_word = (HEADER_LENGTH << 16) | pyld_size;
+
+        m_mem.write(req_base_addr, req_hdr_word);
+        m_mem.write_block(req_base_addr+1, request, n_words);
+
+        m_submitted.push_back({std::chrono::steady_clock::now(), request[0]});
+        return true;
+    }
+
+    // True if the reply of the oldest request in flight is complete
+    bool reply_ready() {
+        if ( m_submitted.empty() ) {
+            return false;
+        }
+
+        if ( !m_check_replies_count ) {
+            return this->oldest_age() >= m_waiter.config().sleep;
+        }
+
+        if ( m_published == 0 ) {
+            // Replies published since the oldest request in flight, the count wraps
+            m_published = std::min<uint32_t>(m_mem.read(STATUS_NUM_REPLIES) - m_num_replies, m_submitted.size());
+        }
+        return m_published > 0;
+    }
+
+    // Wait for the reply of the oldest request in flight, or for wake() to
+    // return true
+    template<typename F>
+    completion::Waiter::Result wait_reply(F&& wake, std::chrono::nanoseconds timeout) {
+        if ( !m_check_replies_count ) {
+            auto remaining = m_waiter.config().sleep - this->oldest_age();
+            if ( remaining.count() > 0 ) {
+                std::this_thread::sleep_for(remaining);
+            }
+            return completion::Waiter::Result::kCompleted;
+        }
+
+        return m_waiter.wait([this]() { return this->reply_ready(); }, wake, timeout);
+    }
+
+    // Read the reply of the oldest request in flight and release its page.
+    // Returns false if the reply does not carry the packet header of the
+    // request, e.g. the late reply of a request that timed out: the pages
+    // are out of step and the transactor must be synced again.
+    bool pop_reply(std::vector<uint32_t>& reply) {
+        reply.resize(this->max_reply_words());
+        size_t n_words = 0;
+        bool matches = this->pop_reply(reply.data(), n_words);
+        reply.resize(n_words);
+        return matches;
+    }
+
+    // Read the reply into a buffer of max_reply_words()
+    bool pop_reply(uint32_t* reply, size_t& n_words) {
+        uint32_t rep_base_addr = STATUS_LENGTH + m_word_per_page * m_next_page;
+
+        // Read the reply size word
+        uint32_t rep_hdr_word = m_mem.read(rep_base_addr);
+        uint32_t rep_size = ((rep_hdr_word >> 16) & 0xffff) + (rep_hdr_word & 0xffff);
+        n_words = std::min(rep_size, this->max_reply_words());
+
+        m_mem.read_block(rep_base_addr+1, reply, n_words);
+
+        bool matches = n_words > 0 && reply[0] == m_submitted.front().header;
+        this->release();
+        return matches;
+    }
+
+    // Time the oldest request in flight has been waiting for its reply
+    std::chrono::nanoseconds oldest_age() const {
+        return std::chrono::steady_clock::now() - m_submitted.front().time;
+    }
+
+private:
+
+    void release() {
+        m_next_page = (m_next_page + 1) % m_num_bufs;
+        ++m_num_replies;
+        m_submitted.pop_front();
+        if ( m_published > 0 ) {
+            --m_published;
+        }
+    }
+
+    devmem::Backend& m_mem;
+    completion::Waiter& m_waiter;
+    uint32_t m_max_depth;
+    bool m_check_replies_count;
+
+    uint32_t m_num_bufs = 0;
+    uint32_t m_word_per_page = 0;
+    uint32_t m_depth = 1;
+
+    // Page of the oldest request in flight
+    uint32_t m_next_page = 0;
+    // Replies count before the reply of the oldest request in flight is published
+    uint32_t m_num_replies = 0;
+    // Replies of the requests in flight known to be published
+    uint32_t m_published = 0;
+
+    struct Pending {
+        std::chrono::steady_clock::time_point time;
+        // Packet header, echoed in the reply
+        uint32_t header;
+    };
+
+    // Requests in flight, oldest first
+    std::deque<Pending> m_submitted;
+};
+
+}
+#endif
@@ -1,14 +1,19 @@
 #pragma once
 #include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #ifndef INPORT_ANY
 #define INPORT_ANY 0
 #endif
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstring>
 #include <string>
 #include <vector>
@@ -50,11 +55,30 @@ public:
     GetSockNameError = -6,
     SendError = -7,
     RecvError = -8,
+    // Nothing to receive on a non-blocking socket, or the receive timed out
+    WouldBlock = -9,
     // AddressError = -66,
   };
 
   static constexpr uint16_t msg_buf_size = 10*1024;
 
+  // Datagrams handled by a single recv_many/send_many system call
+  static constexpr size_t max_batch_size = 64;
+
+  // Datagram in a caller-owned buffer, for the batched calls
+  struct Datagram
+  {
+    void* data = nullptr;
+    // Size of the buffer
+    size_t capacity = 0;
+    // Size of the datagram
+    size_t size = 0;
+    // Set when the received datagram did not fit in the buffer
+    bool truncated = false;
+    // Sender of a received datagram, destination of a sent one
+    IPv4* peer = nullptr;
+  };
+
 private:
 
   int m_sock{ -1 };
@@ -103,6 +127,8 @@ public:
 
   bool is_closed() const { return m_sock < 0; }
 
+  int get_fd() const { return m_sock; }
+
   int bind(const IPv4& ipaddr)
   {
     m_self_addr = ipaddr;
@@ -197,6 +223,141 @@ public:
     return ret;
   }
 
+  // Send size bytes from data, without copying them
+  int send_from(const void* data, size_t size, const IPv4& ipaddr) const
+  {
+    sockaddr_in_t addr_in = ipaddr;
+    int ret = ::sendto(m_sock, data, size, 0, (sockaddr_t*)&addr_in, sizeof(addr_in));
+    if (ret < 0) {
+      throw udp::SendError();
+    }
+    return ret;
+  }
+
+  // Receive a datagram straight into a caller-owned buffer.
+  // Returns the size of the datagram, or Status::WouldBlock when nothing
+  // was received on a non-blocking socket or before the receive timeout.
+  int recv_into(void* data, size_t capacity, IPv4& ipaddr) const
+  {
+    sockaddr_in_t addr_in;
+    socklen_t addr_in_len = sizeof(addr_in);
+    int ret = ::recvfrom(m_sock, data, capacity, 0, (sockaddr_t*)&addr_in, &addr_in_len);
+    if (ret < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return (int)Status::WouldBlock;
+      }
+      throw udp::RecvError();
+    }
+    ipaddr = addr_in;
+    return ret;
+  }
+
+  // Receive up to n datagrams with a single system call. If block is set,
+  // waits for the first one; the others are only those already queued.
+  // Returns the number of datagrams received, or Status::WouldBlock.
+  int recv_many(Datagram* dgrams, size_t n, bool block) const
+  {
+    n = std::min(n, max_batch_size);
+    mmsghdr msgs[max_batch_size];
+    iovec iovs[max_batch_size];
+    sockaddr_in_t addrs[max_batch_size];
+
+    for (size_t i(0); i < n; ++i) {
+      iovs[i] = { dgrams[i].data, dgrams[i].capacity };
+      std::memset(&msgs[i], 0, sizeof(msgs[i]));
+      msgs[i].msg_hdr.msg_name = &addrs[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int ret = ::recvmmsg(m_sock, msgs, n, block ? MSG_WAITFORONE : MSG_DONTWAIT, nullptr);
+    if (ret < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return (int)Status::WouldBlock;
+      }
+      throw udp::RecvError();
+    }
+
+    for (int i(0); i < ret; ++i) {
+      dgrams[i].size = msgs[i].msg_len;
+      dgrams[i].truncated = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC);
+      if (dgrams[i].peer) {
+        *dgrams[i].peer = addrs[i];
+      }
+    }
+    return ret;
+  }
+
+  // Send n datagrams with as few system calls as possible.
+  // Returns the number of datagrams sent.
+  int send_many(const Datagram* dgrams, size_t n) const
+  {
+    mmsghdr msgs[max_batch_size];
+    iovec iovs[max_batch_size];
+    sockaddr_in_t addrs[max_batch_size];
+
+    size_t sent(0);
+    while (sent < n) {
+      size_t batch = std::min(n - sent, max_batch_size);
+      for (size_t i(0); i < batch; ++i) {
+        const Datagram& d = dgrams[sent + i];
+        addrs[i] = *d.peer;
+        iovs[i] = { d.data, d.size };
+        std::memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      int ret = ::sendmmsg(m_sock, msgs, batch, 0);
+      if (ret < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw udp::SendError();
+      }
+      sent += ret;
+    }
+    return sent;
+  }
+
+  int set_recv_buffer_size(int size) const { return this->set_option(SO_RCVBUF, size); }
+
+  int set_send_buffer_size(int size) const { return this->set_option(SO_SNDBUF, size); }
+
+  // Actual size of the receive buffer, which the kernel may have doubled or capped
+  int get_recv_buffer_size() const { return this->get_option(SO_RCVBUF); }
+
+  int get_send_buffer_size() const { return this->get_option(SO_SNDBUF); }
+
+  int set_nonblocking(bool nonblocking) const
+  {
+    int flags = ::fcntl(m_sock, F_GETFL, 0);
+    if (flags < 0) {
+      throw udp::SetSockOptError();
+    }
+    flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    if (::fcntl(m_sock, F_SETFL, flags) < 0) {
+      throw udp::SetSockOptError();
+    }
+    return (int)Status::OK;
+  }
+
+  // Blocking receives return Status::WouldBlock after timeout, zero waits forever
+  int set_recv_timeout(std::chrono::microseconds timeout) const
+  {
+    timeval tv;
+    tv.tv_sec = timeout.count() / 1000000;
+    tv.tv_usec = timeout.count() % 1000000;
+    int ret = ::setsockopt(m_sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+    if (ret < 0) {
+      throw udp::SetSockOptError();
+    }
+    return (int)Status::OK;
+  }
+
   int broadcast(int opt) const
   {
     int ret = ::setsockopt(m_sock, SOL_SOCKET, SO_BROADCAST, (const char*)&opt, sizeof(opt));
@@ -214,6 +375,30 @@ public:
     return this->send(msg_t{}, ipaddr);
   }
 
+private:
+
+  int set_option(int option, int value) const
+  {
+    int ret = ::setsockopt(m_sock, SOL_SOCKET, option, (const char*)&value, sizeof(value));
+    if (ret < 0) {
+      throw udp::SetSockOptError();
+    }
+    return (int)Status::OK;
+  }
+
+  int get_option(int option) const
+  {
+    int value = 0;
+    socklen_t len = sizeof(value);
+    int ret = ::getsockopt(m_sock, SOL_SOCKET, option, (char*)&value, &len);
+    if (ret < 0) {
+      throw udp::SetSockOptError();
+    }
+    return value;
+  }
+
+public:
+
   struct IPv4
   {
     std::array<uint8_t, 4> octets{};
@@ -89,7 +89,8 @@ static inline int _find_equal(const std::string &s) {
 static inline size_t _find_name_end(const std::string &s) {
   size_t i;
   for (i = 0; i < s.length(); ++i) {
-    if (std::ispunct(static_cast<int>(s[i]))) {
+    // dashes and underscores are part of long names, e.g. --max-pages
+    if (s[i] != '-' && s[i] != '_' && std::ispunct(static_cast<int>(s[i]))) {
       break;
     }
   }
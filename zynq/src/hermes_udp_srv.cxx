@@ -1,21 +1,49 @@
 
 #include "UDPSocket.hpp"
 #include "DevMem.hpp"
+#include "EmuTransactor.hpp"
+#include "Completion.hpp"
+#include "Transactor.hpp"
+#include "IPbusPacket.hpp"
+#include "EventLoop.hpp"
+#include "Realtime.hpp"
+#include "BridgeStats.hpp"
+#include "Publisher.hpp"
 #include "argparse.h"
+#include "hermesmodules/HermesRegisterMap.hpp"
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <deque>
+#include <functional>
 #include <map>
+#include <memory>
 #include <chrono>
 #include <thread>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <ctime>
 
 using namespace std::chrono_literals;
 
 static constexpr uint16_t UDP_PORT = 50001;
+static constexpr uint16_t STATS_PORT = 50002;
+static constexpr uint16_t PUBLISH_PORT = 50003;
 
-static constexpr uint32_t HEADER_LENGTH = 0x1;
 static constexpr uint64_t AXI_ADDR_LENGTH = 0x10000;
 static constexpr std::chrono::milliseconds IPBIF_WAIT = 1ms;
 static constexpr std::chrono::seconds IPBIF_TIMEOUT = 1s;
+static constexpr std::chrono::seconds STATS_PERIOD = 60s;
+static constexpr std::chrono::milliseconds PUBLISH_PERIOD = 1000ms;
+// Subscriptions not renewed for this long are dropped
+static constexpr std::chrono::seconds PUBLISH_LEASE = 60s;
+// Replies kept for resend requests, also the number of packets clients may have in flight
+static constexpr size_t REPLY_RING_SIZE = 16;
+static constexpr uint32_t HERMES_MAGIC = 0xdeadbeef;
+// Pages of the emulated transactor
+static constexpr uint32_t EMU_NUM_BUFS = 4;
+static constexpr uint32_t EMU_WORD_PER_PAGE = 512;
 
 
 void print_ipbus_if_status(const std::vector<uint32_t>& status ) {
@@ -31,24 +59,541 @@ void print_ipbus_if_status(const std::vector<uint32_t>& status ) {
 }
 
 
-void print_ipbus_packet(const std::vector<uint32_t>& packet ) {
+void print_ipbus_packet(const uint32_t* packet, size_t size ) {
     std::ios_base::fmtflags f( std::cout.flags() );
 
-    for( uint32_t x : packet ) { 
-        std::cout << "   0x" << std::hex << std::setw(8) << std::setfill('0') << x << std::endl;
+    for( size_t i(0); i<size; ++i ) { 
+        std::cout << "   0x" << std::hex << std::setw(8) << std::setfill('0') << packet[i] << std::endl;
     }
 
     std::cout.flags( f );
 
 }
 
+// Re-read the transactor status at startup, exiting if it is invalid
+void sync_or_exit(transactor::Transactor& tx) {
+    try {
+        tx.sync();
+    } catch (transactor::InvalidStatusError& e) {
+        std::cerr << "ERROR: invalid ipbus interface status, is the firmware loaded?" << std::endl;
+        exit(-1);
+    }
+}
+
+
+// Forward an ipbus packet to the transactor and read back its reply.
+// Returns false if the transactor did not reply in time, or with the reply
+// to another packet.
+bool transact(transactor::Transactor& tx, const std::vector<uint32_t>& request, std::vector<uint32_t>& reply) {
+
+    if (!tx.submit(request)) {
+        return false;
+    }
+
+    if (tx.wait_reply([]() { return false; }, IPBIF_TIMEOUT) != completion::Waiter::Result::kCompleted) {
+        sync_or_exit(tx);
+        return false;
+    }
+
+    if (!tx.pop_reply(reply)) {
+        sync_or_exit(tx);
+        return false;
+    }
+    return true;
+}
+
+
+// Read the firmware identification through the transactor, using packets
+// built from the register map of the firmware the bridge was compiled for
+bool check_firmware(transactor::Transactor& tx) {
+    namespace regmap = dunedaq::hermesmodules::regmap;
+    using regmap::Register;
+
+    std::vector<uint32_t> request = { regmap::ipbus::packet_header(0) };
+    regmap::ipbus::queue_read<regmap::info::magic>(request, 0);
+    regmap::ipbus::queue_read<regmap::info::versions::node>(request, 1);
+    regmap::ipbus::queue_read<regmap::info::generics::node>(request, 2);
+
+    std::vector<uint32_t> reply;
+    if (!transact(tx, request, reply)) {
+        std::cerr << "ERROR: timeout while reading the firmware identification" << std::endl;
+        return false;
+    }
+
+    // Packet header, then a transaction header and a data word per read
+    if (reply.size() < 7) {
+        std::cerr << "ERROR: short reply to the firmware identification request (" << reply.size() << " words)" << std::endl;
+        return false;
+    }
+    for ( size_t i : {1, 3, 5} ) {
+        if ( (reply[i] & 0xf) != 0 ) {
+            std::cerr << "ERROR: firmware identification read failed, transaction header 0x" << std::hex << reply[i] << std::dec << std::endl;
+            return false;
+        }
+    }
+
+    uint32_t magic = reply[2];
+    uint32_t versions = reply[4];
+    uint32_t generics = reply[6];
+
+    std::cout << " - Register map: " << regmap::address_table << std::endl;
+    std::cout << "   * magic   : 0x" << std::hex << magic << std::dec << std::endl;
+    std::cout << "   * version : " << Register<regmap::info::versions::design>::unpack(versions)
+              << "/" << Register<regmap::info::versions::major>::unpack(versions)
+              << "." << Register<regmap::info::versions::minor>::unpack(versions)
+              << "." << Register<regmap::info::versions::patch>::unpack(versions) << std::endl;
+    std::cout << "   * n_mgts  : " << Register<regmap::info::generics::n_mgts>::unpack(generics) << std::endl;
+    std::cout << "   * n_srcs  : " << Register<regmap::info::generics::n_srcs>::unpack(generics) << std::endl;
+
+    if (magic != HERMES_MAGIC) {
+        std::cerr << "ERROR: unexpected magic number 0x" << std::hex << magic << " (expected 0x" << HERMES_MAGIC << ")" << std::dec << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+// Identification registers of the firmware the bridge was compiled for, so
+// that the emulated transactor passes the firmware check
+void seed_emulator(emu::EmuTransactor& emu) {
+    namespace regmap = dunedaq::hermesmodules::regmap;
+    using namespace regmap::info;
+
+    emu.poke(magic.address, HERMES_MAGIC);
+    emu.poke(versions::node.address, regmap::pack_fields<versions::design, versions::major, versions::minor, versions::patch>(1, 0, 9, 3));
+    emu.poke(generics::node.address, regmap::pack_fields<generics::n_mgts, generics::n_srcs>(4, 2));
+}
+
+
+// Serves the ipbus requests received on a UDP socket with a transactor.
+// Requests are received while transactor pages are free, replies are sent
+// back in order as they complete.
+class IPbusBridge {
+public:
+    IPbusBridge(UDPSocket& sock, transactor::Transactor& tx, ipbus::PacketTracker& tracker, bool verbose) :
+        m_sock(sock), m_tx(tx), m_tracker(tracker), m_verbose(verbose),
+        m_req_words(tx.max_request_words()), m_rep_words(tx.max_reply_words()) {
+
+        // Datagram buffers, allocated once: a batch of requests filling the
+        // free pages, and a batch of replies. Requests are written to the
+        // pages, and replies read from them, without further copies.
+        size_t depth = tx.depth();
+        m_req_buffers.resize(depth * m_req_words);
+        m_rep_buffers.resize(depth * m_rep_words);
+        m_req_peers.resize(depth);
+        m_rep_peers.resize(depth);
+        m_req_dgrams.resize(depth);
+        m_rep_dgrams.resize(depth);
+        for (size_t i(0); i < depth; ++i) {
+            m_req_dgrams[i].data = &m_req_buffers[i * m_req_words];
+            m_req_dgrams[i].capacity = m_req_words * sizeof(uint32_t);
+            m_req_dgrams[i].peer = &m_req_peers[i];
+            m_rep_dgrams[i].data = &m_rep_buffers[i * m_rep_words];
+            m_rep_dgrams[i].capacity = m_rep_words * sizeof(uint32_t);
+            m_rep_dgrams[i].peer = &m_rep_peers[i];
+        }
+
+        // Buffer of the replies sent by the bridge itself
+        m_local_rep.resize(std::max<size_t>(m_rep_words, ipbus::STATUS_PACKET_WORDS));
+    }
+
+    // Requests can be received
+    bool can_receive() const { return m_synced && m_tx.can_submit(); }
+
+    // The transactor status could not be read back after dropping the
+    // requests in flight, no request is accepted until it can
+    bool synced() const { return m_synced; }
+
+    // Read the transactor status again, returns true once it is valid
+    bool resync() {
+        try {
+            m_tx.sync();
+        } catch (transactor::InvalidStatusError& e) {
+            if (m_synced) {
+                std::cerr << "Error: " << e.what() << " after dropping the requests in flight, retrying" << std::endl;
+            }
+            m_synced = false;
+            return false;
+        }
+
+        if (!m_synced) {
+            std::cout << "Transactor status valid again, serving requests" << std::endl;
+        }
+        m_synced = true;
+        return true;
+    }
+
+    // Replies are due
+    bool busy() const { return m_tx.in_flight() > 0; }
+
+    // The reply of the oldest request in flight is complete
+    bool reply_ready() { return m_tx.reply_ready(); }
+
+    // Time left before the oldest request in flight times out
+    std::chrono::nanoseconds time_left() const { return IPBIF_TIMEOUT - m_tx.oldest_age(); }
+
+    completion::Waiter& waiter() const { return m_tx.waiter(); }
+
+    // Handler of the replies to the bridge's own packets, called with
+    // nullptr if the reply is lost
+    using InternalHandler = std::function<void(const uint32_t* reply, size_t size)>;
+
+    void set_internal_handler(InternalHandler handler) { m_internal_handler = std::move(handler); }
+
+    // Submit a packet of the bridge itself, in the order of the client
+    // requests. Returns false if no page is free or it does not fit in one.
+    bool submit_internal(const std::vector<uint32_t>& request) {
+        if (!this->can_receive() || !m_tx.submit(request)) {
+            return false;
+        }
+        m_in_flight.push_back({UDPSocket::IPv4(), 0, true});
+        return true;
+    }
+
+    // Receive the pending requests, as many as there are free pages
+    void on_readable() {
+        if (!this->can_receive()) {
+            return;
+        }
+
+        int n_reqs(0);
+        auto t0 = stats::Clock::now();
+        try {
+            n_reqs = m_sock.recv_many(m_req_dgrams.data(), m_tx.depth() - m_tx.in_flight(), false);
+        } catch (udp::RecvError& e) {
+            std::cerr << "Error while receiving data" << std::endl;
+        }
+        if (n_reqs > 0) {
+            m_stats.add(stats::kReceive, stats::Clock::now() - t0);
+        }
+
+        for (int i(0); i < n_reqs; ++i) {
+            ++m_stats.n_requests;
+            const auto& d = m_req_dgrams[i];
+            this->handle_request(static_cast<const uint32_t*>(d.data), d.size / sizeof(uint32_t), d.truncated, *d.peer);
+        }
+    }
+
+    // Wait for the oldest reply, until wake() returns true, and send the replies completed
+    template<typename F>
+    void wait_replies(F&& wake) {
+        if (!this->busy()) {
+            return;
+        }
+
+        if (!m_tx.reply_ready()) {
+            auto result = m_tx.wait_reply(wake, this->time_left());
+            if (result == completion::Waiter::Result::kTimeout) {
+                this->timeout();
+                return;
+            }
+        }
+
+        this->send_replies();
+    }
+
+    // Send the replies completed, without waiting. The requests in flight
+    // are dropped once the oldest has timed out.
+    void poll_replies() {
+        if (!this->busy()) {
+            return;
+        }
+
+        if (m_tx.reply_ready()) {
+            this->send_replies();
+        } else if (this->time_left().count() <= 0) {
+            this->timeout();
+        }
+    }
+
+    void print_stats(std::ostream& os) const {
+        os << "Requests " << m_stats.n_requests << ", replies " << m_stats.n_replies << ", timeouts " << m_stats.n_timeouts << std::endl;
+        m_stats.print(os);
+        m_tx.waiter().print_stats(os);
+        const auto& ts = m_tracker.stats();
+        os << "Packets: forwarded " << ts.n_forwarded << ", without id " << ts.n_unreliable
+           << ", status " << ts.n_status << ", resends " << ts.n_resends << " (missed " << ts.n_resends_missed << ")"
+           << ", duplicates " << ts.n_duplicates << ", unexpected " << ts.n_unexpected
+           << ", malformed " << ts.n_malformed << ", rewinds " << ts.n_rewinds << std::endl;
+    }
+
+    // Counters and stage histograms, as the fields of a JSON object
+    void write_json_fields(std::ostream& os) const {
+        os << "\"in_flight\":" << m_tx.in_flight() << ",";
+        m_stats.write_json(os);
+        os << ",\"completion\":";
+        stats::write_json(os, m_tx.waiter().stats());
+        os << ",\"packets\":";
+        stats::write_json(os, m_tracker.stats());
+    }
+
+private:
+
+    void handle_request(const uint32_t* req_data, size_t req_size, bool truncated, const UDPSocket::IPv4& peer) {
+        if (m_verbose) {
+            std::cout << "Received incoming ipbus packet:" << std::endl;
+            print_ipbus_packet(req_data, req_size);
+        }
+
+        if (truncated || req_size > m_req_words) {
+            std::cerr << "Error: dropping request larger than a page (" << m_req_words << " words)" << std::endl;
+            return;
+        }
+
+        size_t local_size(0);
+        auto action = m_tracker.on_request(req_data, req_size, m_local_rep.data(), m_local_rep.size(), local_size);
+        if (action == ipbus::PacketTracker::Action::kDrop) {
+            return;
+        }
+        if (action == ipbus::PacketTracker::Action::kReply) {
+            try {
+                auto t0 = stats::Clock::now();
+                m_sock.send_from(m_local_rep.data(), local_size * sizeof(uint32_t), peer);
+                m_stats.add(stats::kSend, stats::Clock::now() - t0);
+                ++m_stats.n_replies;
+            } catch (udp::SendError& e) {
+                std::cerr << "Error while sending a reply" << std::endl;
+            }
+            return;
+        }
+
+        ipbus::PacketHeader hdr;
+        ipbus::parse_header(req_data[0], hdr);
+        auto t0 = stats::Clock::now();
+        m_tx.submit(req_data, req_size);
+        m_stats.add(stats::kPageWrite, stats::Clock::now() - t0);
+        m_in_flight.push_back({peer, hdr.type == ipbus::kControl ? hdr.id : uint16_t(0), false});
+    }
+
+    // Send the replies completed, in order
+    void send_replies() {
+        size_t n_reps(0);
+        while (n_reps < m_rep_dgrams.size() && m_tx.reply_ready()) {
+            auto& d = m_rep_dgrams[n_reps];
+            uint32_t* rep_data = static_cast<uint32_t*>(d.data);
+            size_t rep_size(0);
+            // Up to the page read: the reply of a pipelined request may
+            // have been published while the bridge waited for an older one
+            m_stats.add(stats::kTransactorWait, m_tx.oldest_age());
+            auto t0 = stats::Clock::now();
+            bool matches = m_tx.pop_reply(rep_data, rep_size);
+            m_stats.add(stats::kPageRead, stats::Clock::now() - t0);
+            if (!matches) {
+                std::cerr << "Error: reply out of step with the requests, dropping " << m_tx.in_flight() + 1 << " requests" << std::endl;
+                this->drop_in_flight();
+                break;
+            }
+
+            if (m_in_flight.front().internal) {
+                m_in_flight.pop_front();
+                m_internal_handler(rep_data, rep_size);
+                continue;
+            }
+
+            if (m_verbose) {
+                std::cout << "Sending ipbus reply:" << std::endl;
+                print_ipbus_packet(rep_data, rep_size);
+            }
+
+            m_tracker.on_reply(rep_data, rep_size);
+
+            d.size = rep_size * sizeof(uint32_t);
+            *d.peer = m_in_flight.front().peer;
+            m_in_flight.pop_front();
+            ++n_reps;
+        }
+
+        if (n_reps > 0) {
+            try {
+                auto t0 = stats::Clock::now();
+                m_sock.send_many(m_rep_dgrams.data(), n_reps);
+                m_stats.add(stats::kSend, stats::Clock::now() - t0);
+                m_stats.n_replies += n_reps;
+            } catch (udp::SendError& e) {
+                std::cerr << "Error while sending replies" << std::endl;
+            }
+        }
+    }
+
+    void timeout() {
+        std::cerr << "Error: timeout while retrieving reply form ipbus transactor, dropping " << m_tx.in_flight() << " requests" << std::endl;
+        this->drop_in_flight();
+    }
+
+    // The replies of the requests in flight are lost, the client is to send them again
+    void drop_in_flight() {
+        bool rewound = false;
+        for (const auto& r : m_in_flight) {
+            if (r.internal) {
+                m_internal_handler(nullptr, 0);
+                continue;
+            }
+            ++m_stats.n_timeouts;
+            if (r.packet_id != 0 && !rewound) {
+                m_tracker.on_lost(r.packet_id);
+                rewound = true;
+            }
+        }
+        m_in_flight.clear();
+        this->resync();
+    }
+
+    UDPSocket& m_sock;
+    transactor::Transactor& m_tx;
+    ipbus::PacketTracker& m_tracker;
+    bool m_verbose;
+
+    const size_t m_req_words;
+    const size_t m_rep_words;
+    std::vector<uint32_t> m_req_buffers;
+    std::vector<uint32_t> m_rep_buffers;
+    std::vector<UDPSocket::IPv4> m_req_peers;
+    std::vector<UDPSocket::IPv4> m_rep_peers;
+    std::vector<UDPSocket::Datagram> m_req_dgrams;
+    std::vector<UDPSocket::Datagram> m_rep_dgrams;
+    std::vector<uint32_t> m_local_rep;
+
+    // Requests in flight, oldest first
+    struct InFlight {
+        UDPSocket::IPv4 peer;
+        uint16_t packet_id;
+        // Packet of the bridge itself, its reply goes to the internal handler
+        bool internal;
+    };
+    std::deque<InFlight> m_in_flight;
+    InternalHandler m_internal_handler = [](const uint32_t*, size_t) {};
+    bool m_synced = true;
+
+    stats::BridgeStats m_stats;
+};
+
+
+// Transactor window, and the UDP port serving it
+struct WindowConfig {
+    uint64_t base_addr;
+    uint16_t port;
+    uint64_t length;
+};
+
+// Parse a list of windows, e.g. "0xa0020000:50001,0xa0030000:50011:0x8000",
+// the length defaulting to AXI_ADDR_LENGTH
+bool parse_windows(const std::string& list, std::vector<WindowConfig>& windows) {
+    std::istringstream items(list);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        std::istringstream fields(item);
+        std::string base, port, length;
+        if (!std::getline(fields, base, ':') || !std::getline(fields, port, ':')) {
+            return false;
+        }
+        std::getline(fields, length, ':');
+        try {
+            WindowConfig w;
+            w.base_addr = std::stoull(base, nullptr, 0);
+            unsigned long p = std::stoul(port, nullptr, 0);
+            if (p == 0 || p > std::numeric_limits<uint16_t>::max()) {
+                return false;
+            }
+            w.port = p;
+            w.length = length.empty() ? AXI_ADDR_LENGTH : std::stoull(length, nullptr, 0);
+            windows.push_back(w);
+        } catch (std::exception& e) {
+            return false;
+        }
+    }
+    return !windows.empty();
+}
+
+// A transactor window served on its own UDP port. Each window has its own
+// pages, requests in flight and packet IDs.
+struct Window {
+    WindowConfig cfg;
+    std::unique_ptr<devmem::Backend> mem;
+    std::unique_ptr<completion::Waiter> waiter;
+    std::unique_ptr<transactor::Transactor> tx;
+    UDPSocket sock;
+    std::unique_ptr<ipbus::PacketTracker> tracker;
+    std::unique_ptr<IPbusBridge> bridge;
+};
+
+// Wait for a reply on any window, until wake() returns true, and send the
+// replies completed. A single busy window waits with its completion. With
+// several, the replies counts of all of them are polled, so that a window
+// slow to reply does not hold back the replies of the others.
+template<typename F>
+void wait_replies(std::vector<std::unique_ptr<Window>>& windows, F&& wake) {
+    // Busy bridge whose oldest request times out first
+    IPbusBridge* first = nullptr;
+    size_t n_busy(0);
+    for (auto& w : windows) {
+        if (!w->bridge->busy()) {
+            continue;
+        }
+        ++n_busy;
+        if (first == nullptr || w->bridge->time_left() < first->time_left()) {
+            first = w->bridge.get();
+        }
+    }
+
+    if (n_busy == 0) {
+        return;
+    }
+    if (n_busy == 1) {
+        first->wait_replies(wake);
+        return;
+    }
+
+    auto any_ready = [&windows]() {
+        for (auto& w : windows) {
+            if (w->bridge->reply_ready()) {
+                return true;
+            }
+        }
+        return false;
+    };
+    first->waiter().wait(any_ready, wake, first->time_left());
+
+    for (auto& w : windows) {
+        w->bridge->poll_replies();
+    }
+}
+
+bool any_busy(const std::vector<std::unique_ptr<Window>>& windows) {
+    for (const auto& w : windows) {
+        if (w->bridge->busy()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
 int main(int argc, const char* argv[]) {
 
 
     argparse::ArgumentParser parser(argv[0], "Hermes udp ipbus bridge server");
-    parser.add_argument("-d", "--device", "device type", true);
+    parser.add_argument("-d", "--device", "device type: zcu102, wib, or emu for an emulated transactor", true);
     parser.add_argument("-v", "--verbose", "verbosity level", false);
-    parser.add_argument("-c", "--check-replies-count", "Check Replies count", false);
+    parser.add_argument("-c", "--check-replies-count", "Check Replies count (true/false)", false);
+    parser.add_argument("-w", "--completion", "How to wait for the transactor replies: sleep (default), poll, spin-yield, uio", false);
+    parser.add_argument("-i", "--poll-interval-us", "Interval between status reads of the sleep completion, and fixed reply delay without replies count (us)", false);
+    parser.add_argument("-s", "--spin-polls", "Status reads of the spin-yield completion before yielding", false);
+    parser.add_argument("-u", "--uio", "UIO device of the transactor interrupt, for the uio completion", false);
+    parser.add_argument("-p", "--max-pages", "Maximum number of requests in flight in the transactor pages (default: all)", false);
+    parser.add_argument("-n", "--no-packet-ids", "Forward the control packets whatever their packet ID", false);
+    parser.add_argument("-W", "--windows", "Comma-separated transactor windows base:port[:length], each served on its own port (default: per device)", false);
+    parser.add_argument("-a", "--access", "Width of the transactor block accesses: 32, 64, burst (default: per device)", false);
+    parser.add_argument("-b", "--socket-buffer", "Size of the socket receive and send buffers (bytes, default: system)", false);
+    parser.add_argument("-e", "--emu-file", "File backing the register model of the emulated transactor (default: anonymous memory)", false);
+    parser.add_argument("-l", "--emu-delay-us", "Execution time of a request by the emulated transactor (us, default: 0)", false);
+    parser.add_argument("-t", "--stats-port", "UDP port serving the statistics as JSON, 0 to disable (default: 50002)", false);
+    parser.add_argument("-r", "--publish-regs", "Comma-separated register addresses pushed to the subscribers (default: publish mode off)", false);
+    parser.add_argument("-P", "--publish-port", "UDP port of the publish mode subscriptions (default: 50003)", false);
+    parser.add_argument("-m", "--publish-period-ms", "Sampling period of the published registers (ms, default: 1000)", false);
+    parser.add_argument("-C", "--cpu", "CPUs the bridge runs on, e.g. 1 or 0-1 (default: all)", false);
+    parser.add_argument("-R", "--rt-prio", "Run with SCHED_FIFO at this priority, 1-99 (default: normal scheduling)", false);
+    parser.add_argument("-M", "--mlock", "Lock the bridge memory with mlockall", false);
+    parser.add_argument("-F", "--prefault", "Fault in the transactor window and the stack at startup", false);
     parser.enable_help();
 
     auto err = parser.parse(argc, argv);
@@ -65,22 +610,129 @@ int main(int argc, const char* argv[]) {
 
     std::string device = parser.get<std::string>("device");
     bool verbose = parser.exists("verbose");
+    bool check_packet_ids = !parser.exists("no-packet-ids");
     bool check_replies_count = true;
     if (parser.exists("check-replies-count")) {
-        check_replies_count = parser.get<bool>("check-replies-count");
+        auto check = parser.get<std::string>("check-replies-count");
+        if (check == "true" || check == "1") {
+            check_replies_count = true;
+        } else if (check == "false" || check == "0") {
+            check_replies_count = false;
+        } else {
+            std::cerr << "ERROR: invalid check-replies-count " << check << std::endl;
+            return -1;
+        }
+    }
+
+    completion::Config completion_cfg;
+    completion_cfg.sleep = IPBIF_WAIT;
+    if (parser.exists("completion")) {
+        auto name = parser.get<std::string>("completion");
+        if (!completion::parse_strategy(name, completion_cfg.strategy)) {
+            std::cerr << "ERROR: unknown completion " << name << std::endl;
+            return -1;
+        }
+    }
+    if (parser.exists("poll-interval-us")) {
+        completion_cfg.sleep = std::chrono::microseconds(parser.get<uint32_t>("poll-interval-us"));
+    }
+    if (parser.exists("spin-polls")) {
+        completion_cfg.spin_polls = parser.get<uint32_t>("spin-polls");
+    }
+    if (parser.exists("uio")) {
+        completion_cfg.uio_device = parser.get<std::string>("uio");
+    }
+    if (completion_cfg.strategy == completion::Strategy::kUio && completion_cfg.uio_device.empty()) {
+        std::cerr << "ERROR: the uio completion requires a UIO device" << std::endl;
+        return -1;
+    }
+
+    uint32_t max_pages = std::numeric_limits<uint32_t>::max();
+    if (parser.exists("max-pages")) {
+        max_pages = parser.get<uint32_t>("max-pages");
+    }
+
+    int socket_buffer_size = 0;
+    if (parser.exists("socket-buffer")) {
+        socket_buffer_size = parser.get<int>("socket-buffer");
+    }
+
+    std::string emu_file;
+    if (parser.exists("emu-file")) {
+        emu_file = parser.get<std::string>("emu-file");
+    }
+    std::chrono::microseconds emu_delay(0);
+    if (parser.exists("emu-delay-us")) {
+        emu_delay = std::chrono::microseconds(parser.get<uint32_t>("emu-delay-us"));
+    }
+
+    uint16_t stats_port = STATS_PORT;
+    if (parser.exists("stats-port")) {
+        stats_port = parser.get<uint16_t>("stats-port");
+    }
+
+    std::vector<uint32_t> publish_regs;
+    if (parser.exists("publish-regs")) {
+        std::istringstream list(parser.get<std::string>("publish-regs"));
+        std::string addr;
+        while (std::getline(list, addr, ',')) {
+            try {
+                publish_regs.push_back(std::stoul(addr, nullptr, 0));
+            } catch (std::exception& e) {
+                std::cerr << "ERROR: invalid register address " << addr << std::endl;
+                return -1;
+            }
+        }
+    }
+    uint16_t publish_port = PUBLISH_PORT;
+    if (parser.exists("publish-port")) {
+        publish_port = parser.get<uint16_t>("publish-port");
+    }
+    std::chrono::milliseconds publish_period = PUBLISH_PERIOD;
+    if (parser.exists("publish-period-ms")) {
+        publish_period = std::chrono::milliseconds(parser.get<uint32_t>("publish-period-ms"));
     }
 
+    rt::Config rt_cfg;
+    if (parser.exists("cpu")) {
+        auto list = parser.get<std::string>("cpu");
+        if (!rt::parse_cpu_list(list, rt_cfg.cpus)) {
+            std::cerr << "ERROR: invalid CPU list " << list << std::endl;
+            return -1;
+        }
+    }
+    if (parser.exists("rt-prio")) {
+        rt_cfg.rt_prio = parser.get<int>("rt-prio");
+        if (rt_cfg.rt_prio < 1 || rt_cfg.rt_prio > 99) {
+            std::cerr << "ERROR: invalid real-time priority " << rt_cfg.rt_prio << std::endl;
+            return -1;
+        }
+    }
+    rt_cfg.mlock = parser.exists("mlock");
+    rt_cfg.prefault = parser.exists("prefault");
+
     std::cout << "device "  << device << std::endl;
     std::cout << "verbose " << verbose << std::endl;
     std::cout << "check " << check_replies_count << std::endl;
+    if (check_replies_count) {
+        std::cout << "completion " << completion::to_string(completion_cfg.strategy) << std::endl;
+    } else {
+        std::cout << "completion fixed delay of " << completion_cfg.sleep.count() << " us" << std::endl;
+    }
 
-    std::map<std::string, uint64_t> device_baseaddress_map = {
-        {"zcu102", 0x80000000},
-        {"wib", 0xa0020000},
+    // Transactor windows and width of their block accesses. Single 32-bit
+    // accesses by default, the wider ones are for interconnects known to
+    // convert them.
+    struct DeviceInfo {
+        std::vector<WindowConfig> windows;
+        devmem::AccessMode access;
     };
-    
 
-    std::cout << "Device type: " << device << std::endl;
+    std::map<std::string, DeviceInfo> device_baseaddress_map = {
+        {"zcu102", {{{0x80000000, UDP_PORT, AXI_ADDR_LENGTH}}, devmem::AccessMode::k32}},
+        {"wib", {{{0xa0020000, UDP_PORT, AXI_ADDR_LENGTH}}, devmem::AccessMode::k32}},
+        {"emu", {{{0, UDP_PORT, AXI_ADDR_LENGTH}}, devmem::AccessMode::k32}},
+    };
 
     auto device_it = device_baseaddress_map.find(device);
     if ( device_it == device_baseaddress_map.end() ) {
@@ -88,142 +740,229 @@ int main(int argc, const char* argv[]) {
         exit(-1);
     }
 
-    uint64_t axi_base_addr = device_it->second;
+    std::vector<WindowConfig> window_cfgs = device_it->second.windows;
+    if (parser.exists("windows")) {
+        auto list = parser.get<std::string>("windows");
+        window_cfgs.clear();
+        if (!parse_windows(list, window_cfgs)) {
+            std::cerr << "ERROR: invalid window list " << list << std::endl;
+            exit(-1);
+        }
+    }
+    for (size_t i(0); i < window_cfgs.size(); ++i) {
+        for (size_t j(0); j < i; ++j) {
+            if (window_cfgs[i].port == window_cfgs[j].port) {
+                std::cerr << "ERROR: windows 0x" << std::hex << window_cfgs[j].base_addr << " and 0x" << window_cfgs[i].base_addr << std::dec << " on the same port " << window_cfgs[i].port << std::endl;
+                exit(-1);
+            }
+        }
+    }
+    // The interrupt of a transactor only wakes the wait of its own window
+    if (completion_cfg.strategy == completion::Strategy::kUio && window_cfgs.size() > 1) {
+        std::cerr << "ERROR: the uio completion supports a single window" << std::endl;
+        exit(-1);
+    }
 
-    std::cout << " - Mapping memory device at offset " << (void*)axi_base_addr << std::endl;
-    devmem::DevMem mem(axi_base_addr, AXI_ADDR_LENGTH);
-    std::cout << " - Mapping successful" << std::endl;
+    devmem::AccessMode access = device_it->second.access;
+    if (parser.exists("access")) {
+        auto name = parser.get<std::string>("access");
+        if (!devmem::parse_access_mode(name, access)) {
+            std::cerr << "ERROR: unknown access mode " << name << std::endl;
+            exit(-1);
+        }
+    }
 
-    std::cout << " - IPBus interface status" << std::endl;
-    auto s = mem.read_block(0,4);
-    print_ipbus_if_status(s);
+    // Signals are blocked before any thread is started, so that they all
+    // reach the event loop
+    event::EventLoop loop;
+    loop.add_signals({SIGTERM, SIGINT}, [&loop](int sig) {
+        std::cout << "Received " << ::strsignal(sig) << ", shutting down" << std::endl;
+        loop.stop();
+    });
 
-    std::cout << " - Creating receiver at " << UDP_PORT << std::endl;
-	UDPSocket srv;
-	srv.open();
-	srv.bind(UDP_PORT);
-    std::cout << " - Receiver successfully bound" << std::endl;
+    std::cout << "Device type: " << device << std::endl;
 
+    std::vector<std::unique_ptr<Window>> windows;
+    for (const auto& cfg : window_cfgs) {
+        auto w = std::make_unique<Window>();
+        w->cfg = cfg;
 
-    size_t req_count(0);
-    size_t rpl_count(0);
-    size_t to_count(0);
-    while(true) {
+        if (device == "emu") {
+            // Each window has its own register model
+            std::string regs_file = emu_file;
+            if (!regs_file.empty() && window_cfgs.size() > 1) {
+                regs_file += "." + std::to_string(cfg.port);
+            }
+            std::cout << " - Emulated transactor, register model in " << (regs_file.empty() ? "anonymous memory" : regs_file) << ", " << emu_delay.count() << " us per request" << std::endl;
+            try {
+                auto emu = std::make_unique<emu::EmuTransactor>(cfg.length, EMU_NUM_BUFS, EMU_WORD_PER_PAGE, regs_file, emu_delay);
+                seed_emulator(*emu);
+                w->mem = std::move(emu);
+            } catch (emu::EmuMappingError& e) {
+                std::cerr << "ERROR: " << e.what() << std::endl;
+                exit(-1);
+            } catch (devmem::DevMemRangeError& e) {
+                std::cerr << "ERROR: window of 0x" << std::hex << cfg.length << std::dec << " words too short for the emulated transactor" << std::endl;
+                exit(-1);
+            }
+        } else {
+            std::cout << " - Mapping memory device at offset " << (void*)cfg.base_addr << ", block accesses " << devmem::to_string(access) << std::endl;
+            w->mem = std::make_unique<devmem::DevMem>(cfg.base_addr, cfg.length, access, rt_cfg.prefault);
+            std::cout << " - Mapping successful" << std::endl;
+        }
 
+        std::cout << " - IPBus interface status" << std::endl;
+        auto s = w->mem->read_block(0,4);
+        print_ipbus_if_status(s);
 
-        UDPSocket::IPv4 ipaddr; 
-        std::string req_msg;
+        w->waiter = std::make_unique<completion::Waiter>(completion_cfg);
         try {
-            srv.recv(req_msg, ipaddr);
-            ++req_count;
-        } catch (udp::RecvError& e) {
-            std::cerr << "Error while receiving data" << std::endl;
-            continue;
+            w->tx = std::make_unique<transactor::Transactor>(*w->mem, *w->waiter, max_pages, check_replies_count);
+        } catch (transactor::InvalidStatusError& e) {
+            std::cerr << "ERROR: invalid ipbus interface status, is the firmware loaded?" << std::endl;
+            exit(-1);
         }
+        auto& tx = *w->tx;
 
-        std::vector<uint32_t> data_uint32(req_msg.size()/sizeof(uint32_t));
-        ::memcpy(data_uint32.data(), req_msg.data(), req_msg.size());
-        
-        if (verbose) {
-            std::cout << "Received incoming ipbus packet:" << std::endl;
-            print_ipbus_packet(data_uint32);
+        if (!check_firmware(tx)) {
+            std::cerr << "WARNING: firmware check failed, the register map of this build may not match the firmware" << std::endl;
         }
 
-        // Read ipbus interface status
-        auto status = mem.read_block(0,4);
-
-        if ( verbose ) {
-            print_ipbus_if_status(status);
+        std::cout << " - Creating receiver at " << cfg.port << std::endl;
+        auto& srv = w->sock;
+        srv.open();
+        srv.bind(cfg.port);
+        srv.set_nonblocking(true);
+        if (socket_buffer_size > 0) {
+            srv.set_recv_buffer_size(socket_buffer_size);
+            srv.set_send_buffer_size(socket_buffer_size);
         }
+        std::cout << " - Receiver successfully bound, socket buffers " << srv.get_recv_buffer_size() << "/" << srv.get_send_buffer_size() << " bytes" << std::endl;
+        std::cout << " - Up to " << tx.depth() << " requests in flight" << std::endl;
 
-        uint32_t num_buf = status[0];
-        uint32_t word_per_page = status[1];
-        uint32_t next_req_page = status[2];
-        uint32_t num_replies = status[3];
-
-
-        // Next address page
-        uint32_t next_req_base_addr = word_per_page * next_req_page;
-
-        // Prepare header word
-        uint32_t pyld_size = data_uint32.size() - 1;
-        uint32_t hdr_size = HEADER_LENGTH;
-        uint32_t req_hdr_word = (hdr_size << 16 ) | pyld_size;
-
-        mem.write(next_req_base_addr, req_hdr_word);
-        mem.write_block(next_req_base_addr+1, data_uint32);
-
-        std::chrono::time_point start = std::chrono::steady_clock::now();
-        uint64_t wait_counts = 0;
-        // Poll status registers waiting for a reply
-        try {
-            while(true) {
-                ++wait_counts;
-                std::this_thread::sleep_for(IPBIF_WAIT);
-
-                auto status = mem.read_block(0,4);
+        w->tracker = std::make_unique<ipbus::PacketTracker>(REPLY_RING_SIZE, tx.max_request_words() * sizeof(uint32_t), tx.max_reply_words(), check_packet_ids);
+        std::cout << " - " << w->tracker->n_buffers() << " replies kept for resends, packet IDs " << (check_packet_ids ? "checked" : "not checked") << std::endl;
 
-                if ( verbose ) {
-                    print_ipbus_if_status(status);
-                }
+        w->bridge = std::make_unique<IPbusBridge>(srv, tx, *w->tracker, verbose);
+        auto& bridge = *w->bridge;
+        loop.add_fd(srv.get_fd(), [&bridge](uint32_t) { bridge.on_readable(); });
 
-                uint32_t new_num_replies = status[3];
-                if (new_num_replies != num_replies or !check_replies_count) {
-                    break;
-                }
+        windows.push_back(std::move(w));
+    }
 
-                if(std::chrono::steady_clock::now() - start > IPBIF_TIMEOUT) 
-                    throw std::runtime_error("Timed out while waiting for ipbus interface response");
+    // Publish mode: the registers are sampled by the bridge's own packets,
+    // through the first window
+    auto& bridge = *windows.front()->bridge;
+    auto& tx = *windows.front()->tx;
+    UDPSocket pub_srv;
+    std::unique_ptr<publish::Publisher> publisher;
+    if (!publish_regs.empty()) {
+        publisher = std::make_unique<publish::Publisher>(pub_srv, publish_regs, publish_period, PUBLISH_LEASE);
+        if (publisher->request().size() > tx.max_request_words() || publisher->reply_words() > tx.max_reply_words()) {
+            std::cerr << "ERROR: too many published registers for a transactor page" << std::endl;
+            exit(-1);
+        }
+        pub_srv.open();
+        pub_srv.bind(publish_port);
+        pub_srv.set_nonblocking(true);
+        bridge.set_internal_handler([&publisher](const uint32_t* reply, size_t size) { publisher->on_reply(reply, size); });
+        loop.add_fd(pub_srv.get_fd(), [&publisher](uint32_t) { publisher->on_readable(); });
+        loop.add_timer(publish_period, [&publisher]() { publisher->on_tick(); });
+        std::cout << " - Publishing " << publish_regs.size() << " registers every " << publish_period.count() << " ms, subscriptions at " << publish_port << std::endl;
+    }
 
+    // Statistics, on request and as a JSON line every period
+    const auto start = stats::Clock::now();
+    auto write_stats = [&windows, &publisher, start](std::ostream& os) {
+        auto uptime = std::chrono::duration_cast<std::chrono::seconds>(stats::Clock::now() - start);
+        os << "{\"time\":" << std::time(nullptr)
+           << ",\"uptime_s\":" << uptime.count()
+           << ",\"windows\":[";
+        for (size_t i(0); i < windows.size(); ++i) {
+            const auto& w = *windows[i];
+            os << (i ? "," : "") << "{\"port\":" << w.cfg.port << ",\"base_addr\":" << w.cfg.base_addr << ",";
+            w.bridge->write_json_fields(os);
+            os << "}";
+        }
+        os << "]";
+        if (publisher) {
+            os << ",\"publish\":";
+            publisher->write_json(os);
+        }
+        os << "}";
+    };
+    UDPSocket stats_srv;
+    std::unique_ptr<stats::StatsServer> stats_server;
+    if (stats_port != 0) {
+        stats_srv.open();
+        stats_srv.bind(stats_port);
+        stats_srv.set_nonblocking(true);
+        stats_server = std::make_unique<stats::StatsServer>(stats_srv, write_stats);
+        loop.add_fd(stats_srv.get_fd(), [&stats_server](uint32_t) { stats_server->on_readable(); });
+        std::cout << " - Statistics served at " << stats_port << std::endl;
+    }
+    loop.add_timer(STATS_PERIOD, [&write_stats]() {
+        write_stats(std::cout);
+        std::cout << std::endl;
+    });
+
+    // Windows whose transactor status was invalid after a timeout are synced
+    // again until their status is valid
+    loop.add_timer(IPBIF_TIMEOUT, [&windows]() {
+        for (auto& w : windows) {
+            if (!w->bridge->synced()) {
+                w->bridge->resync();
             }
-        } catch ( std::runtime_error &e ) {
-            std::cerr << "Error: timeout while retrieving reply form ipbus transactor" << std::endl;
-            ++to_count;
-            continue;
         }
+    });
 
-         
-        // Calculate base address for reply packet
-        uint32_t next_rep_base_addr = 4 + word_per_page * next_req_page;
+    // The interrupt wait returns when an event is pending
+    for (auto& w : windows) {
+        w->waiter->set_wake_fd(loop.get_fd());
+    }
 
-        // Read the reply size word
-        uint32_t rep_hdr_word = mem.read(next_rep_base_addr);
-        // uint32_t rep_size = (rep_hdr_word & ~HEADER_LENGTH) + 1;
-        uint32_t rep_size = ((rep_hdr_word >> 16) & 0xffff) + (rep_hdr_word & 0xffff);
+    // The buffers are all allocated: lock them, and move to the real-time
+    // settings for serving requests
+    rt::apply(rt_cfg);
+    rt::print_settings(std::cout);
 
-        // Read the reply
-        auto rep_data = mem.read_block(next_rep_base_addr+1, rep_size);
+    // Requests are received only while transactor pages are free
+    auto update_events = [&]() {
+        for (auto& w : windows) {
+            loop.set_events(w->sock.get_fd(), w->bridge->can_receive() ? uint32_t(EPOLLIN) : 0u);
+        }
+    };
 
-        // Prepare reply message
-        std::string rep_msg(rep_data.size()*sizeof(uint32_t), ' ');
-        ::memcpy(rep_msg.data(), rep_data.data(), rep_msg.length());
-        ++rpl_count;
+    while (!loop.stopped()) {
+        // Samples go through the pages as the client requests
+        if (publisher && publisher->due() && bridge.submit_internal(publisher->request())) {
+            publisher->on_submitted();
+        }
 
-        // Send reply
-        // UDPSocket rplr;
-        // rplr.open();
-        // rplr.send(rep_msg, ipaddr);
-        // rplr.close();
-        srv.send(rep_msg, ipaddr);
+        // Wait for the transactor, returning to the loop when an event is pending
+        update_events();
+        wait_replies(windows, [&loop]() { return loop.pending(); });
 
+        // Without replies due, block until the next event. The replies
+        // sent may have freed pages.
+        update_events();
+        loop.run_once(any_busy(windows) ? 0ms : -1ms);
     }
 
+    // Complete the requests in flight
+    while (any_busy(windows)) {
+        wait_replies(windows, []() { return false; });
+    }
 
-    // UDPSocket::IPv4 ipaddr; 
-    // std::string data;
-    // try {
-    //     srv.recv(data, ipaddr);
-    // } catch (udp::RecvError& e) {
-
-    // }
-
-    // std::string response = "aaa";
-    // rplr.send(response, ipaddr);
-
-
-    // std::cout << "toc tpc" << std::endl;
-    // std::cout << "Sender: " << ipaddr.to_string() << std::endl;
-    // std::cout << "RCvdc data: " << data.size() << std::endl;
+    for (auto& w : windows) {
+        std::cout << "Window 0x" << std::hex << w->cfg.base_addr << std::dec << " at " << w->cfg.port << std::endl;
+        w->bridge->print_stats(std::cout);
+        w->sock.close();
+    }
+    if (publisher) {
+        publisher->print_stats(std::cout);
+    }
 
-    srv.close();
+    stats_srv.close();
+    pub_srv.close();
 }
\ No newline at end of file